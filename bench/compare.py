@@ -0,0 +1,63 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2023 SAKURA internet Inc.
+#
+# SPDX-License-Identifier: MIT
+#
+"""Compare two benchmark outputs (the BENCH,... lines of zephyr.exe).
+
+    compare.py baseline.txt current.txt [--tolerance 20]
+
+Fails when a run changed its result, or when its CPU time or p99 callback
+latency grew by more than the tolerance (percent).
+"""
+
+import argparse
+import sys
+
+FIELDS = ("result", "bytes", "Bps", "cpu_us", "cpu_Bps", "p50_ns", "p90_ns", "p99_ns", "max_ns", "uart_tx", "uart_drops")
+
+
+def load(path):
+    runs = {}
+    with open(path) as f:
+        for line in f:
+            cols = line.strip().split(",")
+            if (len(cols) != 3 + len(FIELDS)) or (cols[0] != "BENCH") or (cols[1] == "scenario"):
+                continue
+            runs[(cols[1], cols[2])] = dict(zip(FIELDS, map(int, cols[3:])))
+    return runs
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    ap.add_argument("baseline")
+    ap.add_argument("current")
+    ap.add_argument("--tolerance", type=float, default=20.0, help="allowed growth in percent")
+    args = ap.parse_args()
+
+    base = load(args.baseline)
+    cur = load(args.current)
+    limit = 1.0 + args.tolerance / 100.0
+    bad = 0
+    for key in sorted(base):
+        name = "%s/%s" % key
+        if key not in cur:
+            print("%-20s missing" % name)
+            bad += 1
+            continue
+        b, c = base[key], cur[key]
+        notes = []
+        if b["result"] != c["result"]:
+            notes.append("result %d -> %d" % (b["result"], c["result"]))
+        for field in ("cpu_us", "p99_ns"):
+            if (b[field] > 0) and (c[field] > b[field] * limit):
+                notes.append("%s %d -> %d (+%.0f%%)" % (field, b[field], c[field], 100.0 * (c[field] - b[field]) / b[field]))
+        print("%-20s cpu %6d us (%+6.1f%%)  %s" % (name, c["cpu_us"], 100.0 * (c["cpu_us"] - b["cpu_us"]) / max(b["cpu_us"], 1), "; ".join(notes) or "ok"))
+        if notes:
+            bad += 1
+    return 1 if bad else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,31 @@
+/*
+ * Copyright (c) 2023 SAKURA internet Inc.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <time.h>
+
+#include "host_clock.h"
+
+static uint64_t host_clock_ns(clockid_t id)
+{
+    struct timespec ts;
+
+    if (clock_gettime(id, &ts) != 0) {
+        return 0;
+    }
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+uint64_t BenchHostCpuNs(void)
+{
+    return host_clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+uint64_t BenchHostMonoNs(void)
+{
+    return host_clock_ns(CLOCK_MONOTONIC);
+}
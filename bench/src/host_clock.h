@@ -0,0 +1,19 @@
+/*
+ * Copyright (c) 2023 SAKURA internet Inc.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifndef _HOST_CLOCK_H_
+#define _HOST_CLOCK_H_
+
+#include <stdint.h>
+
+/**
+ * Host clocks for the native build. Kernel time is simulated there and
+ * does not advance while code runs, so execution cost is measured with
+ * these instead.
+ */
+uint64_t BenchHostCpuNs(void);  /* CPU time of the process */
+uint64_t BenchHostMonoNs(void); /* wall clock */
+
+#endif
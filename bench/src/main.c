@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2023 SAKURA internet Inc.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+
+#include "posix_board_if.h"
+
+#include "download_manager.h"
+#include "download_pipeline.h"
+#include "download_sink.h"
+#include "host_clock.h"
+#include "mock_sipf.h"
+#include "uart_broker.h"
+
+LOG_MODULE_REGISTER(sipf, CONFIG_SIPF_LOG_LEVEL);
+
+/*
+ * Runs every scenario in every output mode through DownloadManagerSubmitMode()
+ * (download manager -> cb_fileDownload() -> pipeline -> sink -> UART broker)
+ * and prints one CSV line per run:
+ *   BENCH,<scenario>,<mode>,<result>,<bytes>,<Bps>,<cpu_us>,<cpu_Bps>,
+ *         <p50_ns>,<p90_ns>,<p99_ns>,<max_ns>,<uart_tx>,<uart_drops>
+ * Bps is over simulated time (limited by the link model), cpu_* and the
+ * callback latency percentiles are measured with the host clock.
+ * The exit status is the number of runs with an unexpected result.
+ */
+
+#define UART_DRAIN_MS (200)
+
+#if defined(BENCH_REPLAY_INC)
+static const struct bench_chunk replay[] = {
+#include BENCH_REPLAY_INC
+};
+#endif
+
+struct bench_case {
+    struct bench_scenario sc;
+    int expect; /* 0: success, otherwise the error */
+};
+
+static const struct bench_case cases[] = {
+    {{.name = "lte-m", .size = 65536, .chunk = 1024, .ttfb_ms = 1500, .gap_us = 20000, .jitter_us = 10000}, 0},
+    {{.name = "nb-iot", .size = 16384, .chunk = 512, .ttfb_ms = 4000, .gap_us = 150000, .jitter_us = 100000}, 0},
+    {{.name = "burst", .size = 65536, .chunk = 1024, .ttfb_ms = 0, .gap_us = 0}, 0},
+    {{.name = "drop", .size = 32768, .chunk = 1024, .ttfb_ms = 1500, .gap_us = 20000, .jitter_us = 10000, .drop_at = 20000}, -ECONNRESET},
+#if defined(BENCH_REPLAY_INC)
+    {{.name = "replay", .trace = replay, .trace_len = ARRAY_SIZE(replay)}, 0},
+#endif
+};
+
+static K_SEM_DEFINE(sem_done, 0, 1);
+static int last_result;
+
+static void bench_done(const char *file_id, int result)
+{
+    last_result = result;
+    k_sem_give(&sem_done);
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static uint32_t percentile(const uint32_t *v, uint32_t n, uint32_t p)
+{
+    if (n == 0) {
+        return 0;
+    }
+    return v[MIN((n * p) / 100, n - 1)];
+}
+
+static int bench_run(const struct bench_case *bc, enum download_output_mode mode)
+{
+    struct mock_sipf_result res;
+    struct uart_broker_stats us;
+    uint64_t cpu_ns;
+    int64_t ms;
+    uint32_t n, bps, cpu_bps;
+
+    MockSipfSetScenario(&bc->sc);
+    UartBrokerResetStats();
+    k_sem_reset(&sem_done);
+
+    cpu_ns = BenchHostCpuNs();
+    ms = k_uptime_get();
+    if (DownloadManagerSubmitMode(bc->sc.name, mode) < 0) {
+        return -ENOMEM;
+    }
+    k_sem_take(&sem_done, K_FOREVER);
+    ms = k_uptime_get() - ms;
+    // UARTに残っている分も含める
+    k_sleep(K_MSEC(UART_DRAIN_MS));
+    cpu_ns = BenchHostCpuNs() - cpu_ns;
+
+    MockSipfGetResult(&res);
+    UartBrokerGetStats(&us);
+    n = MIN(res.chunks, CONFIG_BENCH_MAX_CHUNKS);
+    qsort(res.cb_ns, n, sizeof(res.cb_ns[0]), cmp_u32);
+    bps = (ms > 0) ? (uint32_t)(((uint64_t)res.bytes * 1000) / ms) : 0;
+    cpu_bps = (cpu_ns > 0) ? (uint32_t)(((uint64_t)res.bytes * 1000000000ULL) / cpu_ns) : 0;
+
+    printk("BENCH,%s,%s,%d,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u\n", bc->sc.name, DownloadSinkModeName(mode), last_result, res.bytes, bps, (uint32_t)(cpu_ns / 1000), cpu_bps,
+           percentile(res.cb_ns, n, 50), percentile(res.cb_ns, n, 90), percentile(res.cb_ns, n, 99), percentile(res.cb_ns, n, 100), us.tx_bytes, us.tx_drops);
+
+    if (bc->expect == 0) {
+        return (last_result == (int)res.bytes) ? 0 : -EIO;
+    }
+    return (last_result == bc->expect) ? 0 : -EIO;
+}
+
+void main(void)
+{
+    int failed = 0;
+
+    UartBrokerInit(DEVICE_DT_GET(DT_NODELABEL(uart0)));
+    DownloadPipelineInit();
+    DownloadManagerSetDoneCallback(bench_done);
+    DownloadManagerInit();
+
+    printk("BENCH,scenario,mode,result,bytes,Bps,cpu_us,cpu_Bps,p50_ns,p90_ns,p99_ns,max_ns,uart_tx,uart_drops\n");
+    for (size_t i = 0; i < ARRAY_SIZE(cases); i++) {
+        for (int mode = 0; mode < DOWNLOAD_OUTPUT_MODE_NUM; mode++) {
+            if (bench_run(&cases[i], mode) != 0) {
+                failed++;
+            }
+        }
+    }
+    printk("BENCH done, %d failed\n", failed);
+    posix_exit(failed);
+}
@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2023 SAKURA internet Inc.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+
+#include "sipf/sipf_file.h"
+#include "auth_cache.h"
+#include "download_pipeline.h"
+#include "download_stats.h"
+#include "host_clock.h"
+#include "lte_conn.h"
+#include "mock_sipf.h"
+
+/*
+ * Stand-ins for the SIPF library, the LTE link and the download profile.
+ * Gaps between chunks are k_sleep()s, so they cost simulated time only;
+ * the callbacks (the app code under test) are timed with the host clock.
+ */
+
+static const struct bench_scenario *scenario;
+static uint8_t chunk_buff[DOWNLOAD_CHUNK_SZ];
+static uint32_t rng_state = CONFIG_BENCH_SEED;
+
+static uint32_t cb_ns[CONFIG_BENCH_MAX_CHUNKS];
+static uint32_t cb_chunks;
+static uint32_t cb_bytes;
+static uint64_t cb_total_ns;
+
+// xorshift32(シードが同じなら毎回同じデータとジッタ)
+static uint32_t mock_rand(void)
+{
+    uint32_t x = rng_state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    rng_state = x;
+    return x;
+}
+
+static void mock_gap(uint32_t gap_us, uint32_t jitter_us)
+{
+    int64_t us = gap_us;
+
+    if (jitter_us > 0) {
+        us += (int64_t)(mock_rand() % (2 * jitter_us + 1)) - jitter_us;
+    }
+    if (us > 0) {
+        k_sleep(K_USEC(us));
+    }
+}
+
+static void mock_fill(uint8_t *buff, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        buff[i] = (uint8_t)mock_rand();
+    }
+}
+
+/** SIPF library **/
+
+int SipfFileDownload(const char *file_id, uint8_t *buff, size_t sz_download, int (*cb)(uint8_t *buff, size_t len))
+{
+    const struct bench_scenario *sc = scenario;
+    uint32_t sent = 0;
+    size_t n = 0;
+    int ret;
+
+    if (sc == NULL) {
+        return -ENOENT;
+    }
+    if (sz_download > sizeof(chunk_buff)) {
+        sz_download = sizeof(chunk_buff);
+    }
+    k_sleep(K_MSEC(sc->ttfb_ms));
+    for (;;) {
+        size_t len;
+        if (sc->trace != NULL) {
+            if (n >= sc->trace_len) {
+                break;
+            }
+            len = MIN(sc->trace[n].len, sz_download);
+            mock_gap(sc->trace[n].gap_us, 0);
+            n++;
+        } else {
+            if (sent >= sc->size) {
+                break;
+            }
+            len = MIN(MIN(sc->chunk, sz_download), sc->size - sent);
+            if (sent > 0) {
+                mock_gap(sc->gap_us, sc->jitter_us);
+            }
+        }
+        if ((sc->drop_at > 0) && (sent + len > sc->drop_at)) {
+            // 回線断(ライブラリは受信済みの分を返さずにエラーになる)
+            return -ECONNRESET;
+        }
+        mock_fill(chunk_buff, len);
+        ret = cb(chunk_buff, len);
+        if (ret < 0) {
+            return ret;
+        }
+        sent += len;
+    }
+    return sent;
+}
+
+int SipfFileUpload(const char *file_id, uint8_t *buff, size_t sz)
+{
+    return sz;
+}
+
+/** LTE (always registered) **/
+
+int LteConnWait(int timeout_ms)
+{
+    return 0;
+}
+
+int LteConnWaitAwake(int timeout_ms)
+{
+    return 0;
+}
+
+int LteConnWaitRrcIdle(int timeout_ms)
+{
+    return 0;
+}
+
+enum lte_conn_state LteConnGetState(void)
+{
+    return LTE_CONN_REGISTERED;
+}
+
+uint64_t LteConnRrcConnectedMs(void)
+{
+    return k_uptime_get();
+}
+
+/** Auth (nothing to recover) **/
+
+void AuthCacheConfirm(void)
+{
+}
+
+int AuthCacheRecover(int err)
+{
+    return -ENOENT;
+}
+
+/** Download profile: per-callback latency **/
+
+int DownloadStatsInit(void)
+{
+    return 0;
+}
+
+void DownloadStatsBegin(const char *file_id)
+{
+    cb_chunks = 0;
+    cb_bytes = 0;
+    cb_total_ns = 0;
+}
+
+int DownloadStatsCallback(int (*cb)(uint8_t *buff, size_t len), uint8_t *buff, size_t len)
+{
+    uint64_t t = BenchHostMonoNs();
+    int ret = cb(buff, len);
+    uint64_t ns = BenchHostMonoNs() - t;
+
+    if (cb_chunks < ARRAY_SIZE(cb_ns)) {
+        cb_ns[cb_chunks] = (uint32_t)MIN(ns, UINT32_MAX);
+    }
+    cb_chunks++;
+    cb_bytes += len;
+    cb_total_ns += ns;
+    return ret;
+}
+
+void DownloadStatsEnd(int result)
+{
+}
+
+int DownloadStatsUpload(void)
+{
+    return 0;
+}
+
+/** Interface **/
+
+void MockSipfSetScenario(const struct bench_scenario *sc)
+{
+    scenario = sc;
+    rng_state = CONFIG_BENCH_SEED;
+}
+
+void MockSipfGetResult(struct mock_sipf_result *res)
+{
+    res->chunks = cb_chunks;
+    res->bytes = cb_bytes;
+    res->cb_total_ns = cb_total_ns;
+    res->cb_ns = cb_ns;
+}
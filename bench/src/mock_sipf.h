@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) 2023 SAKURA internet Inc.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifndef _MOCK_SIPF_H_
+#define _MOCK_SIPF_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* One recorded chunk: size and the time since the previous one */
+struct bench_chunk {
+    uint16_t len;
+    uint32_t gap_us;
+};
+
+/**
+ * Stream returned by the mocked SipfFileDownload(). Either `trace`
+ * (`trace_len` chunks) is replayed, or `size` bytes are sent in chunks of
+ * `chunk` bytes every `gap_us` +- `jitter_us`. With `drop_at` > 0 the link
+ * is lost once that many bytes are delivered.
+ */
+struct bench_scenario {
+    const char *name;
+    uint32_t size;
+    uint16_t chunk;
+    uint32_t ttfb_ms; /* connect + TLS + request */
+    uint32_t gap_us;
+    uint32_t jitter_us;
+    uint32_t drop_at;
+    const struct bench_chunk *trace;
+    size_t trace_len;
+};
+
+void MockSipfSetScenario(const struct bench_scenario *sc);
+
+/* Latency of every download callback (host ns) of the last download */
+struct mock_sipf_result {
+    uint32_t chunks;
+    uint32_t bytes;
+    uint64_t cb_total_ns;
+    uint32_t *cb_ns; /* min(chunks, CONFIG_BENCH_MAX_CHUNKS) entries */
+};
+void MockSipfGetResult(struct mock_sipf_result *res);
+
+#endif
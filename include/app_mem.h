@@ -0,0 +1,29 @@
+/*
+ * Copyright (c) 2023 SAKURA internet Inc.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifndef _APP_MEM_H_
+#define _APP_MEM_H_
+
+#include <stddef.h>
+
+/**
+ * Static arena for the large application buffers (UART rings, download
+ * pool, flash staging, decoder window, auth credentials, ...).
+ *
+ * Its size is the sum of the *_ARENA_SZ of every module, computed at build
+ * time from the Kconfig options that size them, so the total shows up as
+ * one symbol (app_arena) in the map file. Buffers are carved out once, at
+ * init or first use, and never freed.
+ */
+#define APP_ARENA_ALIGN (8)
+#define APP_ARENA_SIZEOF(sz) (((sz) + APP_ARENA_ALIGN - 1) & ~(size_t)(APP_ARENA_ALIGN - 1))
+
+/** Returns an APP_ARENA_ALIGN aligned, zeroed buffer, or NULL when the arena is exhausted. */
+void *AppArenaAlloc(size_t size, const char *owner);
+
+/** Print the arena use per owner and the stack high-water mark of every thread. */
+void AppMemPrint(void);
+
+#endif
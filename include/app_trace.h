@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2023 SAKURA internet Inc.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifndef _APP_TRACE_H_
+#define _APP_TRACE_H_
+
+#include <stdint.h>
+
+#include "app_mem.h"
+
+/**
+ * Binary trace of the hot paths (CONFIG_APP_TRACE).
+ *
+ * APP_TRACE() stores one fixed-size record (cycle timestamp, event, two
+ * arguments) in a ring in RAM without formatting anything and without a
+ * lock, so it can be called from ISRs and stay enabled in production. The
+ * ring keeps the last CONFIG_APP_TRACE_BUF_COUNT records; AppTraceDump()
+ * ("TRACE" command) sends them as hex lines for scripts/trace_decode.py:
+ *   TRACE,<version>,<cycles per second>,<records since boot>,<count>
+ *   T <hex of up to 8 records>
+ *   TRACE,END,<records overwritten while dumping>
+ */
+
+/* Keep in sync with EVENTS in scripts/trace_decode.py */
+enum app_trace_event {
+    APP_TRACE_NONE = 0,
+    APP_TRACE_LTE_EVT,      /* a: enum lte_lc_evt_type, b: nw_reg_status / lte_mode / rrc_mode / modem_evt */
+    APP_TRACE_LTE_CELL,     /* a: tac, b: cell id */
+    APP_TRACE_LTE_SLEEP,    /* a: sleep type, b: duration [ms] */
+    APP_TRACE_DL_BEGIN,     /* a: chunk size */
+    APP_TRACE_DL_CHUNK,     /* a: chunk length, b: bytes received so far */
+    APP_TRACE_DL_STALL,     /* b: time blocked waiting for a pipeline buffer [ms] */
+    APP_TRACE_DL_SINK,      /* a: chunk length, b: sink error (worker done with the chunk) */
+    APP_TRACE_DL_END,       /* a: chunks, b: result */
+    /* UART events: bit 15 of a is the broker channel (enum uart_broker_ch) */
+    APP_TRACE_UART_TX,      /* a: bytes handed to the driver */
+    APP_TRACE_UART_TX_DONE, /* a: bytes sent, b: duration [cycles] */
+    APP_TRACE_UART_DROP,    /* a: 0 TX / 1 RX, b: bytes dropped */
+    APP_TRACE_UART_RX,      /* a: bytes received */
+    APP_TRACE_EVENT_NUM,
+};
+
+#define APP_TRACE_VERSION (1)
+
+struct app_trace_rec {
+    uint32_t ts;  /* k_cycle_get_32() */
+    uint8_t id;   /* enum app_trace_event */
+    uint8_t seq;  /* ring lap, used to drop records overwritten while read */
+    uint16_t a;
+    uint32_t b;
+};
+
+#if defined(CONFIG_APP_TRACE)
+#define APP_TRACE_ARENA_SZ APP_ARENA_SIZEOF(sizeof(struct app_trace_rec) * CONFIG_APP_TRACE_BUF_COUNT)
+
+int AppTraceInit(void);
+void AppTraceEmit(uint8_t id, uint16_t a, uint32_t b);
+int AppTraceDump(void);
+
+#define APP_TRACE(id, a, b) AppTraceEmit((id), (uint16_t)(a), (uint32_t)(b))
+#else
+#define APP_TRACE_ARENA_SZ (0)
+#define APP_TRACE(id, a, b) ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2023 SAKURA internet Inc.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifndef _AUTH_CACHE_H_
+#define _AUTH_CACHE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "app_mem.h"
+
+#define AUTH_USER_NAME_SZ (255)
+#define AUTH_PASSWORD_SZ (255)
+
+/* user name, password and issue time, taken from the app arena (app_mem.h) */
+#define AUTH_CACHE_ARENA_SZ APP_ARENA_SIZEOF(AUTH_USER_NAME_SZ + AUTH_PASSWORD_SZ + 2 + sizeof(int64_t))
+
+/**
+ * SIM auth credentials for SipfClientHttpSetAuthInfo().
+ *
+ * With CONFIG_APP_AUTH_CACHE the user name/password from SipfAuthRequest()
+ * are kept in settings (NVS) together with the time they were issued, so a
+ * reboot can reuse them instead of doing the auth request again.
+ */
+int AuthCacheInit(void);
+
+/**
+ * Set the cached credentials if they have not expired. Does not need the
+ * network; returns -ENOENT if there are none to use, then call
+ * AuthCacheRefresh() once LTE is registered.
+ */
+int AuthCacheSetup(void);
+
+/**
+ * SipfAuthRequest() with exponential backoff + jitter until it succeeds,
+ * then store and set the new credentials.
+ */
+int AuthCacheRefresh(void);
+
+/** A request with the current credentials succeeded. */
+void AuthCacheConfirm(void);
+
+/**
+ * Called after a request failed with `err`. The library does not report the
+ * HTTP status, so credentials that have not been confirmed since they were
+ * loaded (or that have expired) are assumed to be rejected and refreshed,
+ * unless `err` has another cause (no network, aborted, digest mismatch,
+ * local storage). The auth request is tried at most
+ * CONFIG_APP_AUTH_RECOVER_TRIES times.
+ * Returns 0 if the credentials were refreshed and the request is worth
+ * retrying, -EALREADY otherwise.
+ */
+int AuthCacheRecover(int err);
+
+#endif
@@ -0,0 +1,33 @@
+/*
+ * Copyright (c) 2023 SAKURA internet Inc.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifndef _BOOT_REPORT_H_
+#define _BOOT_REPORT_H_
+
+#include <stdint.h>
+
+/** Boot phases, in the order they normally complete */
+enum boot_phase {
+    BOOT_PHASE_MODEM_INIT = 0, /* nrf_modem_lib_init() done */
+    BOOT_PHASE_PDN,            /* PDN context configured */
+    BOOT_PHASE_SEARCH,         /* lte_lc_connect_async() issued */
+    BOOT_PHASE_CERT,           /* CA certificate checked/provisioned */
+    BOOT_PHASE_CELL,           /* first LTE_LC_EVT_CELL_UPDATE */
+    BOOT_PHASE_REGISTERED,     /* registered to the network */
+    BOOT_PHASE_AUTH,           /* auth info set */
+    BOOT_PHASE_READY,          /* ready for downloads */
+    BOOT_PHASE_NUM,
+};
+
+/** Record the uptime of `phase`. Only the first call per phase counts. */
+void BootReportMark(enum boot_phase phase);
+
+/** Uptime [ms] of `phase`, or -1 if it has not been reached. */
+int64_t BootReportGet(enum boot_phase phase);
+
+/** Print every reached phase with its uptime and the time since the previous one. */
+void BootReportPrint(void);
+
+#endif
@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2023 SAKURA internet Inc.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifndef _DOWNLOAD_CACHE_H_
+#define _DOWNLOAD_CACHE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "download_digest.h"
+#include "download_sink.h"
+
+#if defined(CONFIG_APP_DOWNLOAD_CACHE)
+
+#define DOWNLOAD_CACHE_ENTRIES (CONFIG_APP_DOWNLOAD_CACHE_ENTRIES)
+
+/** Where the copy of a cached file is kept */
+enum download_cache_loc {
+    DOWNLOAD_CACHE_LOC_NONE = 0, /* only written to the UART */
+    DOWNLOAD_CACHE_LOC_FLASH,    /* FLASH_SINK_AREA_FILE from offset 0 */
+};
+
+/**
+ * Metadata of a downloaded file (settings key "fcache/<slot>"). The digest
+ * of the file as stored on the server is its version tag, like an ETag.
+ */
+struct download_cache_entry {
+    char file_id[DOWNLOAD_FILE_ID_MAX];
+    uint32_t size; /* bytes stored (after inflate), or received for LOC_NONE */
+    uint32_t crc;  /* CRC32 of the stored copy (LOC_FLASH) */
+    uint32_t use;  /* LRU counter */
+    uint8_t loc;   /* enum download_cache_loc */
+    uint8_t digest[DOWNLOAD_DIGEST_SZ];
+};
+
+/** Load the entries (settings subtree "fcache"). */
+int DownloadCacheInit(void);
+
+/** Returns 0, or -ENOENT if `file_id` is not cached. */
+int DownloadCacheLookup(const char *file_id, struct download_cache_entry *ent);
+
+/**
+ * true if `file_id` was downloaded or checked against the server less than
+ * CONFIG_APP_DOWNLOAD_CACHE_MAX_AGE_S ago. Not persisted: after a reboot
+ * every entry has to be checked again.
+ */
+bool DownloadCacheFresh(const char *file_id);
+/**
+ * The cached copy was used. Only `server_checked` (compared with the
+ * server's digest) restarts the DownloadCacheFresh() time.
+ */
+void DownloadCacheTouch(const char *file_id, bool server_checked);
+
+/**
+ * Returns 0 if the copy at ent->loc is still the cached file, i.e. flash
+ * was not overwritten by another download since.
+ */
+int DownloadCacheVerify(const struct download_cache_entry *ent);
+
+/** Record a completed download, evicting the least recently used entry. */
+int DownloadCacheUpdate(const struct download_cache_entry *ent);
+int DownloadCacheClear(void);
+
+/** One line per entry on the UART */
+void DownloadCachePrint(void);
+
+#endif /* CONFIG_APP_DOWNLOAD_CACHE */
+
+#endif
@@ -0,0 +1,28 @@
+/*
+ * Copyright (c) 2023 SAKURA internet Inc.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifndef _DOWNLOAD_CHECKPOINT_H_
+#define _DOWNLOAD_CHECKPOINT_H_
+
+#include <stdint.h>
+
+#include "download_sink.h"
+
+/** Last committed point of an interrupted download into the flash sink */
+struct download_checkpoint {
+    char file_id[DOWNLOAD_FILE_ID_MAX];
+    uint32_t offset; /* bytes safely programmed */
+    uint32_t crc;    /* CRC32 of [0, offset) */
+};
+
+/** Load the persisted checkpoint (settings subtree "dl"). */
+int DownloadCheckpointInit(void);
+
+/** Returns 0 if a checkpoint for `file_id` exists, -ENOENT otherwise. */
+int DownloadCheckpointGet(const char *file_id, struct download_checkpoint *ckpt);
+int DownloadCheckpointSave(const char *file_id, uint32_t offset, uint32_t crc);
+int DownloadCheckpointClear(void);
+
+#endif
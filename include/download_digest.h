@@ -0,0 +1,38 @@
+/*
+ * Copyright (c) 2023 SAKURA internet Inc.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifndef _DOWNLOAD_DIGEST_H_
+#define _DOWNLOAD_DIGEST_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Incremental digest of a downloaded file, fed with the same buffers as
+ * the sink. SHA-256 through PSA Crypto (CryptoCell via TF-M) with
+ * CONFIG_APP_DOWNLOAD_DIGEST_SHA256, a table-driven CRC32 otherwise.
+ * CRC32 is output big-endian, i.e. as printed by "%08x".
+ */
+#if defined(CONFIG_APP_DOWNLOAD_DIGEST_SHA256)
+#define DOWNLOAD_DIGEST_SZ (32)
+#else
+#define DOWNLOAD_DIGEST_SZ (4)
+#endif
+
+int DownloadDigestInit(void);
+/** "sha256" or "crc32" */
+const char *DownloadDigestName(void);
+
+int DownloadDigestBegin(void);
+int DownloadDigestUpdate(const uint8_t *data, size_t len);
+int DownloadDigestEnd(uint8_t digest[DOWNLOAD_DIGEST_SZ]);
+
+/** Time spent in DownloadDigestUpdate() since DownloadDigestBegin() [us] */
+uint32_t DownloadDigestBusyUs(void);
+
+/** CRC32 (IEEE 802.3, same as crc32_ieee_update()) with a 256-entry table */
+uint32_t DownloadCrc32Update(uint32_t crc, const uint8_t *data, size_t len);
+
+#endif
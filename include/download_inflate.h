@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2023 SAKURA internet Inc.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifndef _DOWNLOAD_INFLATE_H_
+#define _DOWNLOAD_INFLATE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "app_mem.h"
+
+/**
+ * Streaming decoder for heatshrink compressed files (LZSS, no header).
+ *
+ * The window and lookahead sizes are fixed at build time and must match
+ * the encoder, e.g. for the defaults:
+ *   heatshrink -e -w 10 -l 4 file file.hs
+ * The window is one arena buffer of 2^APP_DOWNLOAD_INFLATE_WINDOW_SZ2
+ * bytes; the expanded data is handed out directly from it, so nothing else
+ * is buffered however large the file is.
+ */
+
+/** Called with expanded data; a negative return aborts the file. */
+typedef int (*download_inflate_out_t)(const uint8_t *data, size_t len);
+
+/** True if `file_id` names a compressed file (APP_DOWNLOAD_INFLATE_SUFFIX). */
+bool DownloadInflateMatch(const char *file_id);
+
+/* Window taken from the app arena (app_mem.h) */
+#if defined(CONFIG_APP_DOWNLOAD_INFLATE)
+#define DOWNLOAD_INFLATE_ARENA_SZ APP_ARENA_SIZEOF(1U << CONFIG_APP_DOWNLOAD_INFLATE_WINDOW_SZ2)
+#else
+#define DOWNLOAD_INFLATE_ARENA_SZ (0)
+#endif
+
+/** Returns 0, or -ENOMEM if the window can't be allocated. */
+int DownloadInflateBegin(download_inflate_out_t out);
+/** Decode one chunk of the compressed stream. Returns 0 or the `out` error. */
+int DownloadInflateWrite(const uint8_t *data, size_t len);
+/** Returns the expanded size of the file. */
+uint32_t DownloadInflateEnd(void);
+
+#endif
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2023 SAKURA internet Inc.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifndef _DOWNLOAD_MANAGER_H_
+#define _DOWNLOAD_MANAGER_H_
+
+#include <stdbool.h>
+
+#include "download_sink.h"
+
+/**
+ * Download queue. File ids submitted from any thread (button, UART command)
+ * are downloaded one after another by the download manager thread, so the
+ * caller never blocks on the network. Queued files are run back to back as
+ * one batch with the auth info set up once by SipfClientHttpSetAuthInfo().
+ */
+int DownloadManagerInit(void);
+
+/**
+ * Queue `file_id` (truncated to DOWNLOAD_FILE_ID_MAX - 1 chars).
+ * Returns the number of queued requests, -EINVAL for an empty id or
+ * -ENOMEM when the queue is full.
+ */
+int DownloadManagerSubmit(const char *file_id);
+
+/** DownloadManagerSubmit() with the output mode to use for this file. */
+int DownloadManagerSubmitMode(const char *file_id, enum download_output_mode mode);
+
+#define DOWNLOAD_MANAGER_MODE_KEEP (-1)
+
+/**
+ * DownloadManagerSubmitMode() with the expected digest of the file
+ * (DOWNLOAD_DIGEST_SZ bytes, NULL for none); `mode` may be
+ * DOWNLOAD_MANAGER_MODE_KEEP. Without a digest and with
+ * CONFIG_APP_DOWNLOAD_DIGEST_SIDECAR it is fetched from
+ * "<file_id>" CONFIG_APP_DOWNLOAD_DIGEST_SUFFIX before the download.
+ */
+int DownloadManagerSubmitDigest(const char *file_id, int mode, const uint8_t *digest);
+
+/**
+ * Queue a firmware image download into the MCUboot secondary slot
+ * (CONFIG_APP_FOTA, -ENOTSUP otherwise). `digest` as for
+ * DownloadManagerSubmitDigest(). The upgrade is requested once the image
+ * is verified; see fota.h.
+ */
+int DownloadManagerSubmitImage(const char *file_id, const uint8_t *digest);
+
+/** Queue an upload of the last download profile (DownloadStatsUpload()). */
+int DownloadManagerSubmitStatsUpload(void);
+
+/** true while a download is running or requests are queued */
+bool DownloadManagerBusy(void);
+
+/** Number of queued (not yet started) requests */
+int DownloadManagerQueued(void);
+
+/**
+ * Drop every queued request and make the running download (also one just
+ * taken from the queue) fail with -ECANCELED at its next chunk. Returns the
+ * number of dropped requests.
+ */
+int DownloadManagerAbort(void);
+
+/** Called on the download manager thread after each download */
+typedef void (*download_manager_done_cb_t)(const char *file_id, int result);
+void DownloadManagerSetDoneCallback(download_manager_done_cb_t cb);
+
+#endif
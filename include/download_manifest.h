@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2023 SAKURA internet Inc.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifndef _DOWNLOAD_MANIFEST_H_
+#define _DOWNLOAD_MANIFEST_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "download_sink.h"
+
+#if defined(CONFIG_APP_DOWNLOAD_DELTA)
+
+#define DOWNLOAD_MANIFEST_MAX_BLOCKS (CONFIG_APP_DOWNLOAD_DELTA_MAX_BLOCKS)
+
+/**
+ * Block hashes of the file stored in the flash sink (settings key
+ * "mfst/m"). Only the first `count` entries of block_crc are persisted.
+ */
+struct download_manifest {
+    char file_id[DOWNLOAD_FILE_ID_MAX];
+    uint32_t size;       /* file size */
+    uint32_t crc;        /* CRC32 of the whole file */
+    uint16_t block_size; /* bytes per block (APP_FLASH_SINK_BUF_SIZE) */
+    uint16_t count;      /* number of blocks */
+    uint32_t block_crc[DOWNLOAD_MANIFEST_MAX_BLOCKS];
+};
+
+int DownloadManifestInit(void);
+/** Load the manifest of `file_id`. Returns 0, or -ENOENT if flash holds another file. */
+int DownloadManifestLoad(const char *file_id, struct download_manifest *mf);
+/** Persist `mf` (file_id, size, crc, block_size and count must be set). */
+int DownloadManifestSave(const struct download_manifest *mf);
+/** Forget the manifest, e.g. before the stored copy is modified. */
+int DownloadManifestClear(void);
+
+#endif /* CONFIG_APP_DOWNLOAD_DELTA */
+
+#endif
@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2023 SAKURA internet Inc.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifndef _DOWNLOAD_PIPELINE_H_
+#define _DOWNLOAD_PIPELINE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "app_mem.h"
+
+/* Largest download chunk; size of each pipeline buffer */
+#define DOWNLOAD_CHUNK_SZ (CONFIG_APP_DOWNLOAD_CHUNK_SIZE)
+
+/* Buffer pool taken from the app arena (app_mem.h) */
+#if defined(CONFIG_APP_DOWNLOAD_PIPELINE)
+#define DOWNLOAD_PIPELINE_ARENA_SZ APP_ARENA_SIZEOF(DOWNLOAD_CHUNK_SZ * CONFIG_APP_DOWNLOAD_PIPELINE_BUF_COUNT)
+#else
+#define DOWNLOAD_PIPELINE_ARENA_SZ (0)
+#endif
+
+/**
+ * Producer/consumer stage between SipfFileDownload() and the download sink.
+ *
+ * The download callback copies each chunk into a buffer taken from a fixed
+ * pool and returns; a worker thread feeds the buffers to the sink in order.
+ * When every buffer is in use the callback blocks (backpressure) until the
+ * sink releases one. Without CONFIG_APP_DOWNLOAD_PIPELINE these calls go to
+ * the sink synchronously.
+ */
+int DownloadPipelineInit(void);
+
+/**
+ * sz_download to pass to SipfFileDownload(). DOWNLOAD_CHUNK_SZ, or with
+ * CONFIG_APP_DOWNLOAD_CHUNK_ADAPTIVE a size tuned from previous downloads.
+ */
+size_t DownloadPipelineChunkSize(void);
+
+/*
+ * End of file is signalled only by DownloadPipelineEnd(); chunk lengths carry
+ * no meaning (the last chunk may be full size when the file size is a
+ * multiple of the chunk size).
+ */
+int DownloadPipelineBegin(const char *file_id);
+/** Returns 0, or the first sink error so the download can be aborted. */
+int DownloadPipelineWrite(const uint8_t *data, size_t len);
+/** Waits until the sink has consumed everything. Returns the DownloadSinkEnd() result. */
+int DownloadPipelineEnd(int result);
+
+/** Counters of the current/last download (reset by DownloadPipelineBegin()) */
+struct download_pipeline_stats {
+    uint32_t bytes;
+    uint32_t chunks;
+    uint32_t stalls;   /* writes that found every buffer in use */
+    uint32_t stall_ms; /* time blocked waiting for a free buffer */
+    uint32_t ttfb_ms;  /* DownloadPipelineBegin() to the first chunk (connect + TLS + request) */
+    uint32_t elapsed_ms;
+};
+void DownloadPipelineGetStats(struct download_pipeline_stats *st);
+
+#endif
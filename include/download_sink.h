@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2023 SAKURA internet Inc.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifndef _DOWNLOAD_SINK_H_
+#define _DOWNLOAD_SINK_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Longest file id (file key) handled, including the terminating NUL */
+#define DOWNLOAD_FILE_ID_MAX (64)
+
+/** Output format of the downloaded file on the UART broker */
+enum download_output_mode {
+    DOWNLOAD_OUTPUT_HEX = 0,
+    DOWNLOAD_OUTPUT_BASE64,
+    DOWNLOAD_OUTPUT_RAW,
+    DOWNLOAD_OUTPUT_NONE,
+    DOWNLOAD_OUTPUT_MODE_NUM,
+};
+
+/**
+ * DOWNLOAD_OUTPUT_RAW framing. Every frame is a 5-byte header followed by
+ * `len` payload bytes:
+ *   [0xAA][0x55][type][len: uint16 LE]
+ * BEGIN carries the file id, DATA the file contents, END the int32 LE
+ * result of the download (received size or negative error).
+ */
+#define DOWNLOAD_RAW_SYNC0 (0xAA)
+#define DOWNLOAD_RAW_SYNC1 (0x55)
+#define DOWNLOAD_RAW_BEGIN ('B')
+#define DOWNLOAD_RAW_DATA ('D')
+#define DOWNLOAD_RAW_END ('E')
+#define DOWNLOAD_RAW_HDR_SZ (5)
+
+/** Default mode of every file */
+int DownloadSinkSetMode(enum download_output_mode mode);
+/**
+ * Mode of the next file only (DownloadSinkBegin() or DownloadSinkReplay()),
+ * -1 for the default mode.
+ */
+int DownloadSinkSetNextMode(int mode);
+enum download_output_mode DownloadSinkGetMode(void);
+const char *DownloadSinkModeName(enum download_output_mode mode);
+
+/** Also store the file in flash (CONFIG_APP_FLASH_SINK) */
+int DownloadSinkSetStore(bool store);
+bool DownloadSinkGetStore(void);
+
+/**
+ * Expected digest (DOWNLOAD_DIGEST_SZ bytes, see download_digest.h) of the
+ * next file, NULL for none. When it does not match, DownloadSinkEnd()
+ * fails with -EBADMSG before the stored copy is accepted.
+ */
+int DownloadSinkSetDigest(const uint8_t *expected);
+/** Digest of the last completed file. Returns -ENOENT if there is none. */
+int DownloadSinkGetDigest(uint8_t *digest);
+
+/**
+ * The next file is a firmware image (CONFIG_APP_FOTA): it is stored into
+ * the MCUboot secondary slot (even with DownloadSinkSetStore(false)), not
+ * written to the UART and not delta-compared. One file only.
+ */
+int DownloadSinkSetImage(bool image);
+
+/** Start of a file. */
+int DownloadSinkBegin(const char *file_id);
+/** One chunk. The data is read in place and not retained. */
+int DownloadSinkWrite(const uint8_t *data, size_t len);
+/**
+ * End of a file. `result` is the SipfFileDownload() return value.
+ * Returns 0, or a negative error if storing/output failed.
+ */
+int DownloadSinkEnd(int result);
+
+/**
+ * Size (after inflate) and CRC32 of the file stored in flash by the last
+ * DownloadSinkEnd(). Returns -ENOENT if it was not stored or failed.
+ */
+int DownloadSinkGetStored(uint32_t *size, uint32_t *crc);
+
+/**
+ * Write the first `size` bytes of the flash copy to the UART in the mode of
+ * the next file, framed as a download of `file_id`. Must not overlap a download.
+ * Returns `size` or a negative error.
+ */
+int DownloadSinkReplay(const char *file_id, uint32_t size);
+
+#endif
@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2023 SAKURA internet Inc.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifndef _DOWNLOAD_STATS_H_
+#define _DOWNLOAD_STATS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "download_sink.h"
+
+/** Profile of the last download */
+struct download_stats {
+    char file_id[DOWNLOAD_FILE_ID_MAX];
+    int32_t result;      /* received size or negative error */
+    uint32_t bytes;
+    uint32_t elapsed_ms; /* SipfFileDownload() call to return */
+    uint32_t ttfb_ms;    /* connect + TLS handshake + request, to the first chunk */
+    uint32_t chunks;
+    uint32_t cb_max_us;  /* longest download callback */
+    uint32_t cb_total_us;
+    uint32_t stalls;     /* callbacks that waited for a pipeline buffer */
+    uint32_t stall_ms;
+    uint32_t bps;        /* bytes / elapsed */
+    uint32_t rrc_ms;     /* time in RRC connected during the download */
+    uint32_t cell_id;
+    int16_t rsrp;        /* dBm, INT16_MIN if unknown */
+    int16_t rsrq_x10;    /* dB * 10, INT16_MIN if unknown */
+    uint8_t band;
+    uint8_t lte_mode;    /* enum lte_lc_lte_mode */
+};
+
+/*
+ * Binary record (little endian), version DOWNLOAD_STATS_VERSION:
+ *   [ver u8][lte_mode u8][band u8][rsv u8][result i32][bytes u32]
+ *   [elapsed_ms u32][ttfb_ms u32][chunks u32][cb_max_us u32][cb_total_us u32]
+ *   [stalls u32][stall_ms u32][bps u32][rrc_ms u32][cell_id u32]
+ *   [rsrp i16][rsrq_x10 i16][uptime_s u32]
+ */
+#define DOWNLOAD_STATS_VERSION (1)
+#define DOWNLOAD_STATS_RECORD_SZ (60)
+
+int DownloadStatsInit(void);
+
+/** Called around each SipfFileDownload() by the download manager */
+void DownloadStatsBegin(const char *file_id);
+/** Wraps the download callback to time it */
+int DownloadStatsCallback(int (*cb)(uint8_t *buff, size_t len), uint8_t *buff, size_t len);
+void DownloadStatsEnd(int result);
+
+void DownloadStatsGet(struct download_stats *st);
+/** Print the last download profile on the UART */
+void DownloadStatsPrint(void);
+/** Encode the last profile as a binary record. Returns its length or -ENOMEM. */
+int DownloadStatsEncode(uint8_t *buf, size_t size);
+/** SipfFileUpload() the binary record as CONFIG_APP_DOWNLOAD_STATS_FILE_ID. */
+int DownloadStatsUpload(void);
+
+#endif
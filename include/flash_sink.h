@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2023 SAKURA internet Inc.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifndef _FLASH_SINK_H_
+#define _FLASH_SINK_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "app_mem.h"
+
+/*
+ * Flash partition that receives downloaded files. Without MCUboot the
+ * secondary non-secure image slot is unused, so it is reused as file store.
+ */
+#ifndef FLASH_SINK_PARTITION
+#define FLASH_SINK_PARTITION slot1_ns_partition
+#endif
+
+/*
+ * MCUboot secondary slot, target of firmware images (CONFIG_APP_FOTA). With
+ * the partition manager the label maps to mcuboot_secondary.
+ */
+#ifndef FLASH_SINK_IMAGE_PARTITION
+#define FLASH_SINK_IMAGE_PARTITION slot1_partition
+#endif
+
+enum flash_sink_area {
+    FLASH_SINK_AREA_FILE = 0, /* FLASH_SINK_PARTITION */
+    FLASH_SINK_AREA_IMAGE,    /* FLASH_SINK_IMAGE_PARTITION */
+    FLASH_SINK_AREA_NUM,
+};
+
+/* Staging buffer taken from the app arena (app_mem.h) */
+#if defined(CONFIG_APP_FLASH_SINK)
+#define FLASH_SINK_ARENA_SZ APP_ARENA_SIZEOF(CONFIG_APP_FLASH_SINK_BUF_SIZE)
+#else
+#define FLASH_SINK_ARENA_SZ (0)
+#endif
+
+int FlashSinkInit(void);
+
+/**
+ * Partition used by the next FlashSinkBegin() and by FlashSinkRead()/Crc().
+ * The image area is opened on first use. Returns -EBUSY while storing.
+ */
+int FlashSinkSelect(enum flash_sink_area area);
+enum flash_sink_area FlashSinkGetArea(void);
+
+/**
+ * Start storing a file. `offset` is 0 for a new file, or a resume point
+ * returned by FlashSinkResumePoint() with `crc` the CRC32 of [0, offset).
+ */
+int FlashSinkBegin(uint32_t offset, uint32_t crc);
+
+/**
+ * Program a chunk, erasing pages just ahead of the write offset. Whole
+ * BUF_SZ blocks are written in place; only the unaligned remainder is staged.
+ * Runs on the download pipeline worker, so it overlaps with network receive.
+ */
+int FlashSinkWrite(const uint8_t *data, size_t len);
+
+/**
+ * Offset and CRC32 of the data programmed so far. Returns -EAGAIN unless the
+ * offset ends on an erase page, since only such points can be resumed from
+ * without rewriting programmed words.
+ */
+int FlashSinkResumePoint(uint32_t *offset, uint32_t *crc);
+
+/**
+ * Block-hash delta (CONFIG_APP_DOWNLOAD_DELTA), call right after
+ * FlashSinkBegin(0, 0). `crc` holds the CRC32 of each BUF_SZ block of the
+ * copy already in flash (`count` blocks, 0 for none); a block whose CRC is
+ * unchanged is neither erased nor programmed. The array is updated in place
+ * with the CRCs of the new file, up to `max` blocks. `changed` (may be NULL)
+ * is called once, right before the first block that differs is erased.
+ */
+typedef void (*flash_sink_delta_cb_t)(void);
+int FlashSinkSetDelta(uint32_t *crc, size_t count, size_t max, flash_sink_delta_cb_t changed);
+/** Bytes skipped as unchanged / bytes programmed since FlashSinkBegin() */
+void FlashSinkGetDelta(size_t *skipped, size_t *programmed);
+
+/** Flush the staged remainder. Returns bytes stored or a negative error. */
+int FlashSinkEnd(void);
+
+int FlashSinkRead(off_t off, void *dst, size_t len);
+/** CRC32 of the first `len` stored bytes, read back from flash. */
+int FlashSinkCrc(size_t len, uint32_t *crc);
+size_t FlashSinkCapacity(void);
+
+#endif
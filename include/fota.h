@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2023 SAKURA internet Inc.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifndef _FOTA_H_
+#define _FOTA_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Firmware update through SIPF file download (CONFIG_APP_FOTA).
+ *
+ * A signed MCUboot image (app_update.bin) is downloaded with
+ * DownloadManagerSubmitImage() and streamed by the flash sink into the
+ * secondary slot; resume and the digest check work as for any stored file.
+ * When it is complete, FotaImageReady() checks the image header and marks
+ * it for a test boot. MCUboot swaps it in at the next reset and reverts
+ * unless FotaConfirm() is called from the new image.
+ */
+int FotaInit(void);
+
+/**
+ * Called by the sink when `size` bytes of image are stored and verified.
+ * Returns 0 when the upgrade is requested, a negative error otherwise.
+ */
+int FotaImageReady(uint32_t size);
+
+/**
+ * Confirm the running image if it is on a test boot, once LTE is registered
+ * (waits for it) and the auth info is set.
+ */
+int FotaConfirm(void);
+
+/** true once an upgrade is requested and waits for the reset */
+bool FotaPending(void);
+
+/**
+ * Returns -EBUSY while FotaPending() if FLASH_SINK_PARTITION overlaps the
+ * secondary slot (TF-M layout), i.e. storing a file would overwrite the
+ * image before the reset; 0 otherwise.
+ */
+int FotaCheckFileStore(void);
+
+#endif
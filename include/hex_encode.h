@@ -0,0 +1,31 @@
+/*
+ * Copyright (c) 2023 SAKURA internet Inc.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifndef _HEX_ENCODE_H_
+#define _HEX_ENCODE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Encode `len` bytes as lower-case hex into `dst`.
+ * `dst` must hold 2 * `len` chars; no NUL terminator is written.
+ */
+void HexEncode(char *dst, const uint8_t *src, size_t len);
+
+/**
+ * Decode exactly 2 * `len` hex chars (either case) from `src` into `dst`.
+ * Returns 0, or -EINVAL on a non-hex char or a short string.
+ */
+int HexDecode(uint8_t *dst, const char *src, size_t len);
+
+/**
+ * Hex-dump `len` bytes to the UART broker data channel (the console
+ * unless CONFIG_UART_BROKER_DATA is set).
+ * Returns the number of characters queued.
+ */
+int HexDumpPut(const uint8_t *data, size_t len);
+
+#endif
@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2023 SAKURA internet Inc.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifndef _HOST_CMD_H_
+#define _HOST_CMD_H_
+
+#include <zephyr/toolchain.h>
+
+/**
+ * Command protocol for a host MCU on the UART broker.
+ *
+ * Requests are lines starting with '$'; arguments are separated by spaces
+ * or commas and an optional "*XX" suffix carries the checksum:
+ *   $FGET <file_id> [hex|base64|raw|none] [digest]
+ *                                          queue a download; `digest` is the
+ *                                          expected value in hex (download_digest.h)
+ *   $FOTA <file_id> [digest]               queue a firmware image download into the
+ *                                          MCUboot secondary slot (fota.h)
+ *   $STAT                                  state and last download profile
+ *   $ABORT                                 drop the queue, cancel the running download
+ *   $ECHO <0|1>                            UART echo back
+ * Every response is one frame
+ *   $<CMD>,<OK|ERR>[,<field>...]*XX\r\n
+ * where XX is the XOR of all bytes between '$' and '*' in upper-case hex
+ * (NMEA style). A finished download is reported with
+ *   $FDONE,<file_id>,<result>*XX
+ * A request with a wrong checksum is answered with ERR,-EBADMSG.
+ */
+
+/** Handler of received lines that are not '$' commands */
+typedef void (*host_cmd_line_cb_t)(const char *line);
+
+/** Start the command thread; it is then the only reader of the UART broker. */
+int HostCmdInit(host_cmd_line_cb_t line_cb);
+
+/** Send one framed response ("$" "*XX\r\n" are added). */
+int HostCmdReply(const char *fmt, ...) __printf_like(1, 2);
+
+#endif
@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2023 SAKURA internet Inc.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifndef _LTE_CONN_H_
+#define _LTE_CONN_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+enum lte_conn_state {
+    LTE_CONN_IDLE = 0,   /* not started */
+    LTE_CONN_SEARCHING,  /* looking for a network (boot or after link loss) */
+    LTE_CONN_PAUSED,     /* offline between search rounds */
+    LTE_CONN_REGISTERED,
+};
+
+/**
+ * Modem and LTE bring-up: modem library, CA certificate, PDN (APN "sakura")
+ * and network registration. With CONFIG_APP_LTE_FAST_BOOT the network
+ * search is started as soon as the PDN is configured and the certificate
+ * is checked while the modem searches.
+ */
+int LteConnStart(void);
+
+/**
+ * Once started, the connection is kept up by a state machine: a search that
+ * times out (CONFIG_APP_LTE_SEARCH_TIMEOUT_MS) switches the preferred mode
+ * between LTE-M and NB-IoT, and after both failed the modem goes offline for
+ * a growing pause before searching again. A link loss after registration
+ * starts the same cycle. It never gives up.
+ */
+
+/**
+ * Wait up to timeout_ms (< 0: forever) until registered. Returns 0,
+ * -EAGAIN on timeout or -ENOTCONN if LteConnStart() did not succeed.
+ */
+int LteConnWait(int timeout_ms);
+
+bool LteConnIsConnected(void);
+enum lte_conn_state LteConnGetState(void);
+/** Number of link losses after the first registration */
+uint32_t LteConnGetReconnects(void);
+
+/**
+ * Wait up to timeout_ms until the modem is out of PSM (already awake, or
+ * LTE_LC_EVT_MODEM_SLEEP_EXIT_PRE_WARNING). Returns 0 or -EAGAIN.
+ * Needs CONFIG_LTE_LC_MODEM_SLEEP_NOTIFICATIONS; without it the modem is
+ * always reported awake.
+ */
+int LteConnWaitAwake(int timeout_ms);
+
+/** Wait up to timeout_ms until the RRC connection is released. Returns 0 or -EAGAIN. */
+int LteConnWaitRrcIdle(int timeout_ms);
+
+/** Total time spent in RRC connected mode since LteConnStart() [ms] */
+uint64_t LteConnRrcConnectedMs(void);
+
+#endif
@@ -6,17 +6,71 @@
 #ifndef _UART_BROKER_H_
 #define _UART_BROKER_H_
 
+#include <stdarg.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdio.h>
 
 #include <zephyr/devicetree.h>
+#include <zephyr/toolchain.h>
 #include <zephyr/drivers/uart.h>
 
+#include "app_mem.h"
+
 #define UART_LABEL DT_NODELABEL(uart0)
+#define UART_DATA_LABEL DT_NODELABEL(uart1)
+
+#define UART_TX_BUF_SZ (CONFIG_UART_BROKER_TX_BUF_SIZE)
+#define UART_RX_BUF_SZ (CONFIG_UART_BROKER_RX_BUF_SIZE)
+#define UART_BROKER_PRINTF_MAX (CONFIG_UART_BROKER_PRINTF_MAX)
+
+/**
+ * One broker instance per UART. Every channel has its own TX/RX buffers,
+ * statistics and, in poll mode, its own thread, so bulk download data on
+ * the data channel and interactive output on the console never wait for
+ * each other. The UartBroker*() calls without a channel use the console.
+ */
+enum uart_broker_ch {
+    UART_BROKER_CONSOLE = 0, /* uart0: log, commands, status */
+#if defined(CONFIG_UART_BROKER_DATA)
+    UART_BROKER_DATA, /* uart1: download output (download_sink.h) */
+#endif
+    UART_BROKER_CH_NUM,
+};
+
+#if !defined(CONFIG_UART_BROKER_DATA)
+/* download output shares the console */
+#define UART_BROKER_DATA UART_BROKER_CONSOLE
+#endif
 
-#define UART_TX_BUF_SZ (256)
-#define UART_RX_BUF_SZ (256)
+/**
+ * QoS of a channel.
+ * INTERACTIVE: writers wait at most 10 ms for TX space, then the rest is
+ * dropped; the poll mode thread runs at a higher priority.
+ * BULK: writers wait up to CONFIG_UART_BROKER_BULK_TIMEOUT_MS, so a slow
+ * reader throttles the download instead of losing data.
+ */
+enum uart_broker_qos {
+    UART_BROKER_QOS_INTERACTIVE = 0,
+    UART_BROKER_QOS_BULK,
+};
+
+/* Rings and DMA buffers of one channel, taken from the app arena (app_mem.h) */
+#if defined(CONFIG_UART_BROKER_TX_ASYNC)
+#define UART_BROKER_CH_ARENA_SZ(tx, rx) (APP_ARENA_SIZEOF(rx) + APP_ARENA_SIZEOF(tx) + 2 * APP_ARENA_SIZEOF(CONFIG_UART_BROKER_RX_DMA_BUF_SIZE))
+#else
+#define UART_BROKER_CH_ARENA_SZ(tx, rx) (APP_ARENA_SIZEOF(rx) + APP_ARENA_SIZEOF(tx))
+#endif
+
+#if defined(CONFIG_UART_BROKER_DATA)
+#define UART_DATA_TX_BUF_SZ (CONFIG_UART_BROKER_DATA_TX_BUF_SIZE)
+#define UART_DATA_RX_BUF_SZ (CONFIG_UART_BROKER_DATA_RX_BUF_SIZE)
+#define UART_BROKER_DATA_ARENA_SZ UART_BROKER_CH_ARENA_SZ(UART_DATA_TX_BUF_SZ, UART_DATA_RX_BUF_SZ)
+#else
+#define UART_BROKER_DATA_ARENA_SZ (0)
+#endif
+
+#define UART_BROKER_ARENA_SZ (UART_BROKER_CH_ARENA_SZ(UART_TX_BUF_SZ, UART_RX_BUF_SZ) + UART_BROKER_DATA_ARENA_SZ)
 
 int UartBrokerInit(const struct device *uart);
 int UartBrokerTerm(void);
@@ -28,15 +82,84 @@ int UartBrokerGetByte(uint8_t *byte);
 int UartBrokerGetByteTm(uint8_t *byte, int timeout_ms);
 int UartBrokerGet(uint8_t *data, int len);
 
+/**
+ * Zero-copy RX. Waits up to timeout_ms (< 0: forever) for received data and
+ * returns the length of the contiguous span at *data (0 on timeout). The span
+ * stays valid until UartBrokerGetBulkFinish() releases `len` bytes of it.
+ * Single consumer only.
+ */
+int UartBrokerGetBulk(uint8_t **data, int timeout_ms);
+void UartBrokerGetBulkFinish(int len);
+
+/**
+ * Read one line ('\n' terminated, trailing '\r' stripped) into `line` as a
+ * NUL-terminated string. Nothing is consumed until a full line (or `size` - 1
+ * bytes) is available. Returns the line length or -EAGAIN on timeout.
+ */
+int UartBrokerReadLine(char *line, int size, int timeout_ms);
+
 int UartBrokerPuts(const char *msg);
 
+/**
+ * printf() into the TX queue. Formatting is done by Zephyr's cbvprintf() one
+ * character at a time, so there is no intermediate buffer; output longer than
+ * UART_BROKER_PRINTF_MAX is truncated. Returns the number of bytes queued.
+ */
+int UartBrokerPrintf(const char *fmt, ...) __printf_like(1, 2);
+int UartBrokerVPrintf(const char *fmt, va_list ap);
+
 void UartBrokerClearRecveiveQueue(void);
 
-#define UartBrokerPrint(...)                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                           \
-    {                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                  \
-        char msg[140];                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                 \
-        int len = sprintf(msg, __VA_ARGS__);                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                           \
-        UartBrokerPut((uint8_t *)msg, len);                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                            \
-    }
+/**
+ * TX engine activity since UartBrokerInit().
+ * wakeups: TX bursts (DMA transfers, or broker thread wake-ups in poll mode)
+ * active_us: time spent transmitting, idle_us: everything else
+ */
+struct uart_broker_activity {
+    uint32_t wakeups;
+    uint64_t active_us;
+    uint64_t idle_us;
+};
+void UartBrokerGetActivity(struct uart_broker_activity *act);
+
+/**
+ * Queue statistics since UartBrokerInit() / UartBrokerResetStats().
+ * tx_*: UartBrokerPut*()/Printf() and echo back into the TX queue
+ * (ring_tx or msgq_tx), rx_*: the RX ring filled by the UART ISR.
+ * drops are bytes that did not fit (TX: after the 10 ms wait), hwm the
+ * highest queue fill level in bytes and tx_blocked_us the time writers
+ * waited for TX space. Use them to size UART_TX_BUF_SZ / UART_RX_BUF_SZ.
+ */
+struct uart_broker_stats {
+    uint32_t tx_bytes;
+    uint32_t tx_drops;
+    uint32_t tx_hwm;
+    uint32_t tx_blocked_us;
+    uint32_t rx_bytes;
+    uint32_t rx_drops;
+    uint32_t rx_hwm;
+};
+void UartBrokerGetStats(struct uart_broker_stats *st);
+void UartBrokerResetStats(void);
+
+/**
+ * Channel instances. UartBrokerChInit() sets up `ch` on `uart`; until it
+ * succeeds, output to a channel other than the console goes to the console.
+ * The functions behave as the console ones above.
+ */
+int UartBrokerChInit(enum uart_broker_ch ch, const struct device *uart, enum uart_broker_qos qos);
+bool UartBrokerChReady(enum uart_broker_ch ch);
+bool UartBrokerChSetEcho(enum uart_broker_ch ch, bool echo);
+int UartBrokerChPut(enum uart_broker_ch ch, uint8_t *data, int len);
+int UartBrokerChPuts(enum uart_broker_ch ch, const char *msg);
+int UartBrokerChPrintf(enum uart_broker_ch ch, const char *fmt, ...) __printf_like(2, 3);
+int UartBrokerChVPrintf(enum uart_broker_ch ch, const char *fmt, va_list ap);
+int UartBrokerChGet(enum uart_broker_ch ch, uint8_t *data, int len);
+int UartBrokerChReadLine(enum uart_broker_ch ch, char *line, int size, int timeout_ms);
+void UartBrokerChGetActivity(enum uart_broker_ch ch, struct uart_broker_activity *act);
+void UartBrokerChGetStats(enum uart_broker_ch ch, struct uart_broker_stats *st);
+void UartBrokerChResetStats(enum uart_broker_ch ch);
+/** TX/RX buffer sizes of `ch` (for the hwm of its stats) */
+void UartBrokerChGetBufSize(enum uart_broker_ch ch, uint32_t *tx, uint32_t *rx);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,185 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2023 SAKURA internet Inc.
+#
+# SPDX-License-Identifier: MIT
+#
+"""Decode the binary trace dumped by the "TRACE" command (app_trace.h).
+
+    trace_decode.py [capture.log ...] [--csv] [--summary]
+
+Reads a UART capture (or stdin), finds the TRACE,... / T ... / TRACE,END
+lines and prints one line per record with the time since the first one.
+"""
+
+import argparse
+import fileinput
+import struct
+import sys
+
+TRACE_VERSION = 1
+REC = struct.Struct("<IBBHI")  # struct app_trace_rec
+
+# enum app_trace_event: (name, label of a, label of b)
+EVENTS = {
+    1: ("LTE_EVT", "type", "value"),
+    2: ("LTE_CELL", "tac", "cell_id"),
+    3: ("LTE_SLEEP", "type", "ms"),
+    4: ("DL_BEGIN", "chunk_sz", None),
+    5: ("DL_CHUNK", "len", "total"),
+    6: ("DL_STALL", None, "ms"),
+    7: ("DL_SINK", "len", "err"),
+    8: ("DL_END", "chunks", "result"),
+    9: ("UART_TX", "len", None),
+    10: ("UART_TX_DONE", "len", "cycles"),
+    11: ("UART_DROP", "rx", "bytes"),
+    12: ("UART_RX", "len", None),
+}
+
+# enum lte_lc_evt_type (NCS 2.3 modem/lte_lc.h)
+LTE_EVT_TYPES = [
+    "NW_REG_STATUS",
+    "PSM_UPDATE",
+    "EDRX_UPDATE",
+    "RRC_UPDATE",
+    "CELL_UPDATE",
+    "LTE_MODE_UPDATE",
+    "TAU_PRE_WARNING",
+    "NEIGHBOR_CELL_MEAS",
+    "MODEM_SLEEP_EXIT_PRE_WARNING",
+    "MODEM_SLEEP_EXIT",
+    "MODEM_SLEEP_ENTER",
+    "MODEM_EVENT",
+]
+
+SIGNED_B = ("err", "result")
+
+UART_EVENTS = (9, 10, 11, 12)
+UART_CH = ("console", "data")
+
+
+class Dump:
+    def __init__(self, hz, total, count):
+        self.hz = hz
+        self.total = total
+        self.count = count
+        self.lost = None
+        self.records = []
+
+
+def parse(lines):
+    dumps = []
+    cur = None
+    for line in lines:
+        line = line.strip()
+        # ログの途中から始まっていてもよい
+        pos = line.find("TRACE,")
+        if pos >= 0:
+            cols = line[pos:].split(",")
+            if cols[1] == "END":
+                if cur is not None:
+                    cur.lost = int(cols[2])
+                    dumps.append(cur)
+                cur = None
+            elif int(cols[1]) == TRACE_VERSION:
+                cur = Dump(int(cols[2]), int(cols[3]), int(cols[4]))
+            else:
+                sys.stderr.write("unsupported trace version %s\n" % cols[1])
+                cur = None
+            continue
+        if (cur is not None) and line.startswith("T "):
+            data = bytes.fromhex(line[2:])
+            for off in range(0, len(data) - REC.size + 1, REC.size):
+                cur.records.append(REC.unpack_from(data, off))
+    return dumps
+
+
+def timeline(dump):
+    """(seconds since the first record, id, seq, a, b), unwrapping the 32-bit cycle counter."""
+    out = []
+    base = None
+    prev = 0
+    wraps = 0
+    for ts, rid, seq, a, b in dump.records:
+        if base is None:
+            base = ts
+        elif ts < prev:
+            wraps += 1
+        prev = ts
+        t = ((wraps << 32) + ts - base) / dump.hz
+        out.append((t, rid, seq, a, b))
+    return out
+
+
+def fmt_args(rid, a, b):
+    name, la, lb = EVENTS.get(rid, ("EVT%d" % rid, "a", "b"))
+    args = []
+    if rid in UART_EVENTS:
+        # bit15はチャンネル
+        args.append("ch=%s" % UART_CH[a >> 15])
+        a &= 0x7FFF
+    if la is not None:
+        if (rid == 1) and (a < len(LTE_EVT_TYPES)):
+            args.append("type=%s" % LTE_EVT_TYPES[a])
+        else:
+            args.append("%s=%d" % (la, a))
+    if lb is not None:
+        if lb in SIGNED_B:
+            b = struct.unpack("<i", struct.pack("<I", b))[0]
+        args.append("%s=%d" % (lb, b))
+    return name, " ".join(args)
+
+
+def summary(rows):
+    counts = {}
+    chunk_t = []
+    for t, rid, _, a, b in rows:
+        name = EVENTS.get(rid, ("EVT%d" % rid,))[0]
+        if (rid in UART_EVENTS) and (a >> 15):
+            name += "/data"
+        counts[name] = counts.get(name, 0) + 1
+        if rid == 5:
+            chunk_t.append(t)
+    for name in sorted(counts):
+        print("%-14s %6d" % (name, counts[name]))
+    if len(chunk_t) > 1:
+        gaps = sorted(b - a for a, b in zip(chunk_t, chunk_t[1:]))
+        print("chunk gap      avg %.1f ms, p90 %.1f ms, max %.1f ms" % (1000.0 * sum(gaps) / len(gaps), 1000.0 * gaps[int(0.9 * (len(gaps) - 1))], 1000.0 * gaps[-1]))
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    ap.add_argument("files", nargs="*", help="UART captures (default: stdin)")
+    ap.add_argument("--csv", action="store_true", help="t_ms,event,a,b per record")
+    ap.add_argument("--summary", action="store_true", help="event counts and chunk gaps")
+    args = ap.parse_args()
+
+    dumps = parse(fileinput.input(args.files or ("-",), errors="replace"))
+    if not dumps:
+        sys.stderr.write("no trace dump found\n")
+        return 1
+    for dump in dumps:
+        rows = timeline(dump)
+        overwritten = dump.total - dump.count
+        if not args.csv:
+            print("# %d records (%d since boot, %d overwritten, %d lost while dumping), %d Hz" % (len(rows), dump.total, overwritten, dump.lost, dump.hz))
+        else:
+            print("t_ms,event,a,b")
+        for t, rid, _, a, b in rows:
+            if args.csv:
+                name = EVENTS.get(rid, ("EVT%d" % rid,))[0]
+                if rid in UART_EVENTS:
+                    if a >> 15:
+                        name += "/data"
+                    a &= 0x7FFF
+                print("%.3f,%s,%d,%d" % (1000.0 * t, name, a, b))
+            else:
+                name, text = fmt_args(rid, a, b)
+                print("%12.3f ms  %-14s %s" % (1000.0 * t, name, text))
+        if args.summary:
+            summary(rows)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2023 SAKURA internet Inc.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+
+#include "app_mem.h"
+#include "app_trace.h"
+#include "auth_cache.h"
+#include "download_inflate.h"
+#include "download_manifest.h"
+#include "download_pipeline.h"
+#include "flash_sink.h"
+#include "uart_broker.h"
+
+LOG_MODULE_DECLARE(sipf, CONFIG_SIPF_LOG_LEVEL);
+
+#if defined(CONFIG_APP_DOWNLOAD_DELTA)
+#define MANIFEST_ARENA_SZ APP_ARENA_SIZEOF(sizeof(struct download_manifest))
+#else
+#define MANIFEST_ARENA_SZ (0)
+#endif
+
+#define ARENA_SZ                                                                                                                                                                   \
+    (UART_BROKER_ARENA_SZ + DOWNLOAD_PIPELINE_ARENA_SZ + FLASH_SINK_ARENA_SZ + DOWNLOAD_INFLATE_ARENA_SZ + MANIFEST_ARENA_SZ + AUTH_CACHE_ARENA_SZ + APP_TRACE_ARENA_SZ +          \
+     CONFIG_APP_ARENA_EXTRA)
+
+#define ARENA_OWNERS_MAX (16)
+
+struct arena_owner {
+    const char *owner;
+    uint32_t size;
+};
+
+static uint8_t app_arena[ARENA_SZ] __aligned(APP_ARENA_ALIGN);
+static size_t arena_used;
+static struct arena_owner arena_owners[ARENA_OWNERS_MAX];
+static int arena_owner_cnt;
+static struct k_spinlock lock_arena;
+
+void *AppArenaAlloc(size_t size, const char *owner)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock_arena);
+    size_t sz = APP_ARENA_SIZEOF(size);
+    void *p = NULL;
+
+    if (arena_used + sz <= sizeof(app_arena)) {
+        p = &app_arena[arena_used];
+        arena_used += sz;
+        if (arena_owner_cnt < ARENA_OWNERS_MAX) {
+            arena_owners[arena_owner_cnt].owner = owner;
+            arena_owners[arena_owner_cnt].size = sz;
+            arena_owner_cnt++;
+        }
+    }
+    k_spin_unlock(&lock_arena, key);
+    if (p == NULL) {
+        LOG_ERR("arena: %s needs %u bytes, %u left", owner, (uint32_t)sz, (uint32_t)(sizeof(app_arena) - arena_used));
+    }
+    return p;
+}
+
+#if defined(CONFIG_APP_STACK_REPORT)
+#define THREADS_MAX (16)
+
+static k_tid_t threads[THREADS_MAX];
+static int thread_cnt;
+
+static void app_mem_collect(const struct k_thread *thread, void *user_data)
+{
+    if (thread_cnt < THREADS_MAX) {
+        threads[thread_cnt++] = (k_tid_t)thread;
+    }
+}
+
+static void app_mem_stacks(void)
+{
+    // スタックの走査はスレッド一覧のロックの外で行う
+    thread_cnt = 0;
+    k_thread_foreach_unlocked(app_mem_collect, NULL);
+    UartBrokerPuts("* Stack (size / max used)\r\n");
+    for (int i = 0; i < thread_cnt; i++) {
+        size_t unused = 0;
+        size_t size = threads[i]->stack_info.size;
+        const char *name = k_thread_name_get(threads[i]);
+
+        if (k_thread_stack_space_get(threads[i], &unused) != 0) {
+            continue;
+        }
+        UartBrokerPrintf("*  %-18s %5u / %5u (%u%%)\r\n", (name != NULL) ? name : "?", (uint32_t)size, (uint32_t)(size - unused),
+                         (size > 0) ? (uint32_t)((size - unused) * 100 / size) : 0);
+    }
+}
+#endif
+
+void AppMemPrint(void)
+{
+    UartBrokerPrintf("* Arena %u / %u bytes\r\n", (uint32_t)arena_used, (uint32_t)sizeof(app_arena));
+    for (int i = 0; i < arena_owner_cnt; i++) {
+        UartBrokerPrintf("*  %-18s %5u\r\n", arena_owners[i].owner, arena_owners[i].size);
+    }
+#if defined(CONFIG_APP_STACK_REPORT)
+    app_mem_stacks();
+#endif
+}
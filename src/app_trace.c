@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2023 SAKURA internet Inc.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdint.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/util.h>
+
+#include "app_mem.h"
+#include "app_trace.h"
+#include "hex_encode.h"
+#include "uart_broker.h"
+
+#define REC_NUM (CONFIG_APP_TRACE_BUF_COUNT)
+#define REC_SZ (sizeof(struct app_trace_rec))
+#define DUMP_LINE (8)
+
+BUILD_ASSERT(IS_POWER_OF_TWO(REC_NUM), "CONFIG_APP_TRACE_BUF_COUNT must be a power of two");
+BUILD_ASSERT(sizeof(struct app_trace_rec) == 12, "trace record layout is decoded by scripts/trace_decode.py");
+
+static struct app_trace_rec *ring;
+/* 書き込んだレコードの総数(次のレコードの番号) */
+static atomic_t head;
+
+/* lap of record `idx`; the writer marks the slot with ~lap while it fills it */
+static inline uint8_t trace_lap(uint32_t idx)
+{
+    return (uint8_t)(idx / REC_NUM);
+}
+
+int AppTraceInit(void)
+{
+    ring = AppArenaAlloc(APP_TRACE_ARENA_SZ, "trace");
+    if (ring == NULL) {
+        return -ENOMEM;
+    }
+    return 0;
+}
+
+void AppTraceEmit(uint8_t id, uint16_t a, uint32_t b)
+{
+    struct app_trace_rec *r;
+    uint32_t idx;
+
+    if (ring == NULL) {
+        return;
+    }
+    // スロットの確保だけをアトミックに行う(ISRからも呼べる)
+    idx = (uint32_t)atomic_inc(&head);
+    r = &ring[idx & (REC_NUM - 1)];
+    r->seq = ~trace_lap(idx);
+    compiler_barrier();
+    r->ts = k_cycle_get_32();
+    r->id = id;
+    r->a = a;
+    r->b = b;
+    compiler_barrier();
+    r->seq = trace_lap(idx);
+}
+
+int AppTraceDump(void)
+{
+    struct app_trace_rec line[DUMP_LINE];
+    char hex[sizeof(line) * 2 + 1];
+    uint32_t end, idx;
+    uint32_t lost = 0;
+    int n = 0;
+
+    if (ring == NULL) {
+        return -ENODEV;
+    }
+    end = (uint32_t)atomic_get(&head);
+    idx = (end > REC_NUM) ? end - REC_NUM : 0;
+    UartBrokerPrintf("TRACE,%d,%u,%u,%u\r\n", APP_TRACE_VERSION, sys_clock_hw_cycles_per_sec(), end, end - idx);
+    for (; idx < end; idx++) {
+        const struct app_trace_rec *r = &ring[idx & (REC_NUM - 1)];
+        uint8_t lap = trace_lap(idx);
+
+        // 読んでいる間に上書きされたレコードは捨てる
+        if (r->seq != lap) {
+            lost++;
+            continue;
+        }
+        line[n] = *r;
+        compiler_barrier();
+        if (r->seq != lap) {
+            lost++;
+            continue;
+        }
+        if (++n == DUMP_LINE) {
+            HexEncode(hex, (const uint8_t *)line, n * REC_SZ);
+            hex[n * REC_SZ * 2] = '\0';
+            UartBrokerPrintf("T %s\r\n", hex);
+            n = 0;
+        }
+    }
+    if (n > 0) {
+        HexEncode(hex, (const uint8_t *)line, n * REC_SZ);
+        hex[n * REC_SZ * 2] = '\0';
+        UartBrokerPrintf("T %s\r\n", hex);
+    }
+    UartBrokerPrintf("TRACE,END,%u\r\n", lost);
+    return end;
+}
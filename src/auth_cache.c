@@ -0,0 +1,225 @@
+/*
+ * Copyright (c) 2023 SAKURA internet Inc.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/random/rand32.h>
+#include <zephyr/settings/settings.h>
+
+#if defined(CONFIG_DATE_TIME)
+#include <date_time.h>
+#endif
+
+#include "sipf/sipf_auth.h"
+#include "sipf/sipf_client_http.h"
+#include "app_mem.h"
+#include "auth_cache.h"
+#include "uart_broker.h"
+
+LOG_MODULE_DECLARE(sipf, CONFIG_SIPF_LOG_LEVEL);
+
+#define RETRY_MIN_MS (CONFIG_APP_AUTH_RETRY_MIN_MS)
+#define RETRY_MAX_MS (CONFIG_APP_AUTH_RETRY_MAX_MS)
+
+struct auth_cred {
+    char user_name[AUTH_USER_NAME_SZ];
+    char password[AUTH_PASSWORD_SZ];
+    int64_t issued; /* UNIX time [ms] of SipfAuthRequest(), 0: unknown */
+};
+
+static struct auth_cred *cred; /* from the arena */
+BUILD_ASSERT(sizeof(struct auth_cred) <= AUTH_CACHE_ARENA_SZ, "AUTH_CACHE_ARENA_SZ is too small");
+static bool cred_confirmed;
+static K_MUTEX_DEFINE(lock_auth);
+
+#if defined(CONFIG_APP_AUTH_CACHE)
+
+#define KEY_CRED "auth/cred"
+#define TTL_MS ((int64_t)CONFIG_APP_AUTH_CACHE_TTL_MIN * 60 * MSEC_PER_SEC)
+
+static bool cred_cached;
+
+static int auth_cache_set(const char *key, size_t len, settings_read_cb read_cb, void *cb_arg)
+{
+    const char *next;
+
+    if (settings_name_steq(key, "cred", &next) && (next == NULL)) {
+        if (len != sizeof(*cred)) {
+            return -EINVAL;
+        }
+        if (read_cb(cb_arg, cred, sizeof(*cred)) != sizeof(*cred)) {
+            return -EIO;
+        }
+        cred->user_name[sizeof(cred->user_name) - 1] = '\0';
+        cred->password[sizeof(cred->password) - 1] = '\0';
+        cred_cached = true;
+        return 0;
+    }
+    return -ENOENT;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(auth_cache, "auth", NULL, auth_cache_set, NULL, NULL);
+
+#endif
+
+static int64_t auth_cache_now(void)
+{
+#if defined(CONFIG_DATE_TIME)
+    int64_t now;
+    if (date_time_now(&now) == 0) {
+        return now;
+    }
+#endif
+    return 0;
+}
+
+/* 発行からTTLを過ぎたか(時刻が分からない場合は期限内とみなす) */
+static bool auth_cache_expired(void)
+{
+#if defined(CONFIG_APP_AUTH_CACHE)
+    int64_t now = auth_cache_now();
+
+    if ((now == 0) || (cred->issued == 0)) {
+        return false;
+    }
+    return (now - cred->issued) > TTL_MS;
+#else
+    return false;
+#endif
+}
+
+/* 失敗するたびに待ち時間を倍にし、半分をランダムにする */
+static uint32_t auth_backoff(uint32_t *delay_ms)
+{
+    uint32_t d = *delay_ms;
+
+    *delay_ms = MIN(d * 2, RETRY_MAX_MS);
+    return (d / 2) + (sys_rand32_get() % (d / 2 + 1));
+}
+
+/* tries: SipfAuthRequest()を試す回数(0: 成功するまで) */
+static int auth_cache_request(uint32_t tries)
+{
+    uint32_t delay_ms = RETRY_MIN_MS;
+    uint32_t wait_ms;
+    int err;
+
+    k_mutex_lock(&lock_auth, K_FOREVER);
+    // 認証モードをSIM認証にする
+    for (uint32_t n = 1;; n++) {
+        UartBrokerPuts("Set AuthMode to `SIM Auth'... \r\n");
+        err = SipfAuthRequest(cred->user_name, sizeof(cred->user_name), cred->password, sizeof(cred->password));
+        LOG_DBG("SipfAuthRequest(): %d", err);
+        if (err >= 0) {
+            break;
+        }
+        if ((tries != 0) && (n >= tries)) {
+            // 呼び出し元(ダウンロードマネージャ)を止め続けない
+            UartBrokerPuts("faild\r\n");
+            k_mutex_unlock(&lock_auth);
+            return err;
+        }
+        // IPアドレス認証に失敗した
+        wait_ms = auth_backoff(&delay_ms);
+        UartBrokerPrintf("faild(Retry after %ums)\r\n", wait_ms);
+        k_sleep(K_MSEC(wait_ms));
+    }
+    UartBrokerPuts("OK\r\n");
+    cred->issued = auth_cache_now();
+    cred_confirmed = false;
+#if defined(CONFIG_APP_AUTH_CACHE)
+    err = settings_save_one(KEY_CRED, cred, sizeof(*cred));
+    if (err) {
+        LOG_ERR("settings_save_one(%s) failed: %d", KEY_CRED, err);
+    }
+    cred_cached = (err == 0);
+#endif
+    err = SipfClientHttpSetAuthInfo(cred->user_name, cred->password);
+    k_mutex_unlock(&lock_auth);
+    return err;
+}
+
+/* 認証情報が原因かもしれない失敗か */
+static bool auth_cache_suspect(int err)
+{
+    switch (err) {
+    case -ENETUNREACH: // 圏外
+    case -ECANCELED:   // 中断された
+    case -ENOENT:      // ファイルがない
+    case -EBADMSG:     // ダイジェスト不一致
+    case -ESTALE:
+    case -EIO:
+    case -ENOMEM:
+    case -ENOSPC:
+        return false;
+    default:
+        return true;
+    }
+}
+
+/** Interface **/
+
+int AuthCacheInit(void)
+{
+    cred = AppArenaAlloc(sizeof(*cred), "auth cred");
+    if (cred == NULL) {
+        return -ENOMEM;
+    }
+#if defined(CONFIG_APP_AUTH_CACHE)
+    int err = settings_subsys_init();
+    if (err) {
+        LOG_ERR("settings_subsys_init() failed: %d", err);
+        return err;
+    }
+    return settings_load_subtree("auth");
+#else
+    return 0;
+#endif
+}
+
+int AuthCacheRefresh(void)
+{
+    return auth_cache_request(0);
+}
+
+int AuthCacheSetup(void)
+{
+#if defined(CONFIG_APP_AUTH_CACHE)
+    int err = -ENOENT;
+
+    k_mutex_lock(&lock_auth, K_FOREVER);
+    if (cred_cached && !auth_cache_expired()) {
+        err = SipfClientHttpSetAuthInfo(cred->user_name, cred->password);
+        if (err >= 0) {
+            UartBrokerPuts("Use cached auth info\r\n");
+        }
+    }
+    k_mutex_unlock(&lock_auth);
+    return (err < 0) ? -ENOENT : err;
+#else
+    return -ENOENT;
+#endif
+}
+
+void AuthCacheConfirm(void)
+{
+    cred_confirmed = true;
+}
+
+int AuthCacheRecover(int err)
+{
+    if (!auth_cache_suspect(err)) {
+        return -EALREADY;
+    }
+    if (cred_confirmed && !auth_cache_expired()) {
+        return -EALREADY;
+    }
+    LOG_INF("Refresh auth info (%d)", err);
+    return (auth_cache_request(CONFIG_APP_AUTH_RECOVER_TRIES) < 0) ? -EALREADY : 0;
+}
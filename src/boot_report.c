@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2023 SAKURA internet Inc.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdint.h>
+
+#include <zephyr/kernel.h>
+
+#include "boot_report.h"
+#include "uart_broker.h"
+
+static const char *const phase_name[BOOT_PHASE_NUM] = {
+    [BOOT_PHASE_MODEM_INIT] = "modem init",
+    [BOOT_PHASE_PDN] = "pdn",
+    [BOOT_PHASE_SEARCH] = "search",
+    [BOOT_PHASE_CERT] = "cert",
+    [BOOT_PHASE_CELL] = "cell found",
+    [BOOT_PHASE_REGISTERED] = "registered",
+    [BOOT_PHASE_AUTH] = "auth",
+    [BOOT_PHASE_READY] = "ready",
+};
+
+/* 0: not reached (uptime is stored + 1 so that 0 ms is representable) */
+static int64_t phase_ms[BOOT_PHASE_NUM];
+
+void BootReportMark(enum boot_phase phase)
+{
+    if ((phase < BOOT_PHASE_NUM) && (phase_ms[phase] == 0)) {
+        phase_ms[phase] = k_uptime_get() + 1;
+    }
+}
+
+int64_t BootReportGet(enum boot_phase phase)
+{
+    if ((phase >= BOOT_PHASE_NUM) || (phase_ms[phase] == 0)) {
+        return -1;
+    }
+    return phase_ms[phase] - 1;
+}
+
+void BootReportPrint(void)
+{
+    int64_t prev = 0;
+
+    UartBrokerPuts("* Boot report\r\n");
+    for (int i = 0; i < BOOT_PHASE_NUM; i++) {
+        int64_t ms = BootReportGet(i);
+        if (ms < 0) {
+            continue;
+        }
+        // フェーズは並行して進むので、差分が負になることもある
+        UartBrokerPrintf("*  %-10s %6u ms (%+d)\r\n", phase_name[i], (uint32_t)ms, (int)(ms - prev));
+        prev = ms;
+    }
+}
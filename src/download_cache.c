@@ -0,0 +1,224 @@
+/*
+ * Copyright (c) 2023 SAKURA internet Inc.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/settings/settings.h>
+
+#include "download_cache.h"
+#include "flash_sink.h"
+#include "hex_encode.h"
+#include "uart_broker.h"
+
+LOG_MODULE_DECLARE(sipf, CONFIG_SIPF_LOG_LEVEL);
+
+#define KEY_CACHE "fcache"
+#define MAX_AGE_MS ((int64_t)CONFIG_APP_DOWNLOAD_CACHE_MAX_AGE_S * MSEC_PER_SEC)
+
+BUILD_ASSERT(DOWNLOAD_CACHE_ENTRIES <= 10, "entries are keyed by a single digit");
+
+static struct download_cache_entry entries[DOWNLOAD_CACHE_ENTRIES];
+/* この起動中に最後にサーバの値と照合した時刻(保存しない) */
+static int64_t checked_ms[DOWNLOAD_CACHE_ENTRIES];
+static bool checked[DOWNLOAD_CACHE_ENTRIES];
+static uint32_t use_seq;
+
+static int download_cache_set(const char *key, size_t len, settings_read_cb read_cb, void *cb_arg)
+{
+    struct download_cache_entry ent;
+    int slot = key[0] - '0';
+
+    if ((slot < 0) || (slot >= DOWNLOAD_CACHE_ENTRIES) || (key[1] != '\0')) {
+        return -ENOENT;
+    }
+    if (len != sizeof(ent)) {
+        // ダイジェストの種類が違うビルドで保存したもの
+        return -EINVAL;
+    }
+    if (read_cb(cb_arg, &ent, sizeof(ent)) != sizeof(ent)) {
+        return -EIO;
+    }
+    ent.file_id[sizeof(ent.file_id) - 1] = '\0';
+    entries[slot] = ent;
+    use_seq = MAX(use_seq, ent.use);
+    return 0;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(download_cache, KEY_CACHE, NULL, download_cache_set, NULL, NULL);
+
+static int download_cache_find(const char *file_id)
+{
+    for (int i = 0; i < DOWNLOAD_CACHE_ENTRIES; i++) {
+        if ((entries[i].file_id[0] != '\0') && (strncmp(entries[i].file_id, file_id, sizeof(entries[i].file_id)) == 0)) {
+            return i;
+        }
+    }
+    return -ENOENT;
+}
+
+static int download_cache_save(int slot)
+{
+    char key[sizeof(KEY_CACHE) + 2];
+    int err;
+
+    snprintf(key, sizeof(key), KEY_CACHE "/%d", slot);
+    if (entries[slot].file_id[0] == '\0') {
+        return settings_delete(key);
+    }
+    err = settings_save_one(key, &entries[slot], sizeof(entries[slot]));
+    if (err) {
+        LOG_ERR("settings_save_one(%s) failed: %d", key, err);
+    }
+    return err;
+}
+
+/** Interface **/
+
+int DownloadCacheInit(void)
+{
+    int err = settings_subsys_init();
+    if (err) {
+        LOG_ERR("settings_subsys_init() failed: %d", err);
+        return err;
+    }
+    return settings_load_subtree(KEY_CACHE);
+}
+
+int DownloadCacheLookup(const char *file_id, struct download_cache_entry *ent)
+{
+    int slot = download_cache_find(file_id);
+
+    if (slot < 0) {
+        return -ENOENT;
+    }
+    *ent = entries[slot];
+    return 0;
+}
+
+bool DownloadCacheFresh(const char *file_id)
+{
+    int slot = download_cache_find(file_id);
+
+    if ((slot < 0) || !checked[slot]) {
+        return false;
+    }
+    return (k_uptime_get() - checked_ms[slot]) < MAX_AGE_MS;
+}
+
+void DownloadCacheTouch(const char *file_id, bool server_checked)
+{
+    int slot = download_cache_find(file_id);
+
+    if (slot < 0) {
+        return;
+    }
+    // 期限内の再利用やホストの期待値では延長しない(サーバの変更を見逃し続ける)
+    if (server_checked) {
+        checked[slot] = true;
+        checked_ms[slot] = k_uptime_get();
+    }
+    // LRUの順位はメモリ上だけ更新する(照合のたびにフラッシュへ書かない)
+    entries[slot].use = ++use_seq;
+}
+
+int DownloadCacheVerify(const struct download_cache_entry *ent)
+{
+    uint32_t crc;
+    int err;
+
+    if (ent->loc != DOWNLOAD_CACHE_LOC_FLASH) {
+        return -ENOENT;
+    }
+    err = FlashSinkSelect(FLASH_SINK_AREA_FILE);
+    if (err) {
+        return err;
+    }
+    if (ent->size > FlashSinkCapacity()) {
+        return -ENOENT;
+    }
+    // 別のファイル(途中で失敗したものも含む)で上書きされていないか
+    err = FlashSinkCrc(ent->size, &crc);
+    if (err) {
+        return err;
+    }
+    return (crc == ent->crc) ? 0 : -ESTALE;
+}
+
+int DownloadCacheUpdate(const struct download_cache_entry *ent)
+{
+    int slot = download_cache_find(ent->file_id);
+
+    if (slot < 0) {
+        // 空きがなければ一番使われていないものを捨てる
+        slot = 0;
+        for (int i = 0; i < DOWNLOAD_CACHE_ENTRIES; i++) {
+            if (entries[i].file_id[0] == '\0') {
+                slot = i;
+                break;
+            }
+            if (entries[i].use < entries[slot].use) {
+                slot = i;
+            }
+        }
+    }
+    if (ent->loc == DOWNLOAD_CACHE_LOC_FLASH) {
+        // フラッシュに置けるのは1ファイルだけ
+        for (int i = 0; i < DOWNLOAD_CACHE_ENTRIES; i++) {
+            if ((i != slot) && (entries[i].loc == DOWNLOAD_CACHE_LOC_FLASH)) {
+                entries[i].loc = DOWNLOAD_CACHE_LOC_NONE;
+                download_cache_save(i);
+            }
+        }
+    }
+    entries[slot] = *ent;
+    entries[slot].file_id[sizeof(entries[slot].file_id) - 1] = '\0';
+    entries[slot].use = ++use_seq;
+    checked[slot] = true;
+    checked_ms[slot] = k_uptime_get();
+    return download_cache_save(slot);
+}
+
+int DownloadCacheClear(void)
+{
+    int err = 0;
+
+    for (int i = 0; i < DOWNLOAD_CACHE_ENTRIES; i++) {
+        if (entries[i].file_id[0] == '\0') {
+            continue;
+        }
+        memset(&entries[i], 0, sizeof(entries[i]));
+        checked[i] = false;
+        if (download_cache_save(i) != 0) {
+            err = -EIO;
+        }
+    }
+    return err;
+}
+
+void DownloadCachePrint(void)
+{
+    char hex[DOWNLOAD_DIGEST_SZ * 2 + 1];
+    int64_t now = k_uptime_get();
+
+    for (int i = 0; i < DOWNLOAD_CACHE_ENTRIES; i++) {
+        const struct download_cache_entry *ent = &entries[i];
+        if (ent->file_id[0] == '\0') {
+            continue;
+        }
+        HexEncode(hex, ent->digest, sizeof(ent->digest));
+        hex[sizeof(hex) - 1] = '\0';
+        UartBrokerPrintf("%s: %u bytes, %s, %s %s, ", ent->file_id, ent->size, (ent->loc == DOWNLOAD_CACHE_LOC_FLASH) ? "flash" : "uart", DownloadDigestName(), hex);
+        if (checked[i]) {
+            UartBrokerPrintf("checked %u s ago\r\n", (uint32_t)((now - checked_ms[i]) / MSEC_PER_SEC));
+        } else {
+            UartBrokerPuts("not checked\r\n");
+        }
+    }
+}
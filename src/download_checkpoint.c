@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2023 SAKURA internet Inc.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/settings/settings.h>
+
+#include "download_checkpoint.h"
+
+LOG_MODULE_DECLARE(sipf, CONFIG_SIPF_LOG_LEVEL);
+
+#define KEY_CKPT "dl/ckpt"
+
+static struct download_checkpoint ckpt;
+static bool ckpt_valid;
+
+static int download_checkpoint_set(const char *key, size_t len, settings_read_cb read_cb, void *cb_arg)
+{
+    const char *next;
+
+    if (settings_name_steq(key, "ckpt", &next) && (next == NULL)) {
+        if (len != sizeof(ckpt)) {
+            return -EINVAL;
+        }
+        if (read_cb(cb_arg, &ckpt, sizeof(ckpt)) != sizeof(ckpt)) {
+            return -EIO;
+        }
+        ckpt.file_id[sizeof(ckpt.file_id) - 1] = '\0';
+        ckpt_valid = true;
+        return 0;
+    }
+    return -ENOENT;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(download_checkpoint, "dl", NULL, download_checkpoint_set, NULL, NULL);
+
+int DownloadCheckpointInit(void)
+{
+    int err = settings_subsys_init();
+    if (err) {
+        LOG_ERR("settings_subsys_init() failed: %d", err);
+        return err;
+    }
+    return settings_load_subtree("dl");
+}
+
+int DownloadCheckpointGet(const char *file_id, struct download_checkpoint *out)
+{
+    if (!ckpt_valid || (strncmp(ckpt.file_id, file_id, sizeof(ckpt.file_id)) != 0)) {
+        return -ENOENT;
+    }
+    *out = ckpt;
+    return 0;
+}
+
+int DownloadCheckpointSave(const char *file_id, uint32_t offset, uint32_t crc)
+{
+    int err;
+
+    memset(&ckpt, 0, sizeof(ckpt));
+    strncpy(ckpt.file_id, file_id, sizeof(ckpt.file_id) - 1);
+    ckpt.offset = offset;
+    ckpt.crc = crc;
+    err = settings_save_one(KEY_CKPT, &ckpt, sizeof(ckpt));
+    if (err) {
+        LOG_ERR("settings_save_one(%s) failed: %d", KEY_CKPT, err);
+        return err;
+    }
+    ckpt_valid = true;
+    LOG_DBG("checkpoint: %s @ %u", file_id, offset);
+    return 0;
+}
+
+int DownloadCheckpointClear(void)
+{
+    if (!ckpt_valid) {
+        return 0;
+    }
+    ckpt_valid = false;
+    return settings_delete(KEY_CKPT);
+}
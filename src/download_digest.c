@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2023 SAKURA internet Inc.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/byteorder.h>
+
+#if defined(CONFIG_APP_DOWNLOAD_DIGEST_SHA256)
+#include <psa/crypto.h>
+#endif
+
+#include "download_digest.h"
+
+LOG_MODULE_DECLARE(sipf, CONFIG_SIPF_LOG_LEVEL);
+
+/* Reflected CRC32 table, generated at compile time (8 shift/xor steps per entry) */
+#define CRC_S(c) (((c) >> 1) ^ (0xedb88320U & (0U - ((c)&1U))))
+#define CRC_E(n) CRC_S(CRC_S(CRC_S(CRC_S(CRC_S(CRC_S(CRC_S(CRC_S((uint32_t)(n)))))))))
+#define CRC_E4(n) CRC_E(n), CRC_E((n) + 1), CRC_E((n) + 2), CRC_E((n) + 3)
+#define CRC_E16(n) CRC_E4(n), CRC_E4((n) + 4), CRC_E4((n) + 8), CRC_E4((n) + 12)
+#define CRC_E64(n) CRC_E16(n), CRC_E16((n) + 16), CRC_E16((n) + 32), CRC_E16((n) + 48)
+
+static const uint32_t crc_lut[256] = {CRC_E64(0), CRC_E64(64), CRC_E64(128), CRC_E64(192)};
+
+#if defined(CONFIG_APP_DOWNLOAD_DIGEST_SHA256)
+static psa_hash_operation_t hash_op;
+#else
+static uint32_t crc;
+#endif
+static uint64_t busy_cyc;
+
+uint32_t DownloadCrc32Update(uint32_t c, const uint8_t *data, size_t len)
+{
+    c = ~c;
+    while (len > 0) {
+        c = crc_lut[(c ^ *data++) & 0xff] ^ (c >> 8);
+        len--;
+    }
+    return ~c;
+}
+
+int DownloadDigestInit(void)
+{
+#if defined(CONFIG_APP_DOWNLOAD_DIGEST_SHA256)
+    psa_status_t status = psa_crypto_init();
+    if (status != PSA_SUCCESS) {
+        LOG_ERR("psa_crypto_init() failed: %d", status);
+        return -EIO;
+    }
+#endif
+    return 0;
+}
+
+const char *DownloadDigestName(void)
+{
+    return IS_ENABLED(CONFIG_APP_DOWNLOAD_DIGEST_SHA256) ? "sha256" : "crc32";
+}
+
+int DownloadDigestBegin(void)
+{
+    busy_cyc = 0;
+#if defined(CONFIG_APP_DOWNLOAD_DIGEST_SHA256)
+    psa_hash_abort(&hash_op);
+    hash_op = psa_hash_operation_init();
+    if (psa_hash_setup(&hash_op, PSA_ALG_SHA_256) != PSA_SUCCESS) {
+        return -EIO;
+    }
+#else
+    crc = 0;
+#endif
+    return 0;
+}
+
+int DownloadDigestUpdate(const uint8_t *data, size_t len)
+{
+    uint32_t cyc = k_cycle_get_32();
+    int err = 0;
+
+#if defined(CONFIG_APP_DOWNLOAD_DIGEST_SHA256)
+    if (psa_hash_update(&hash_op, data, len) != PSA_SUCCESS) {
+        err = -EIO;
+    }
+#else
+    crc = DownloadCrc32Update(crc, data, len);
+#endif
+    busy_cyc += k_cycle_get_32() - cyc;
+    return err;
+}
+
+int DownloadDigestEnd(uint8_t digest[DOWNLOAD_DIGEST_SZ])
+{
+#if defined(CONFIG_APP_DOWNLOAD_DIGEST_SHA256)
+    size_t len;
+
+    if (psa_hash_finish(&hash_op, digest, DOWNLOAD_DIGEST_SZ, &len) != PSA_SUCCESS) {
+        psa_hash_abort(&hash_op);
+        return -EIO;
+    }
+#else
+    sys_put_be32(crc, digest);
+#endif
+    return 0;
+}
+
+uint32_t DownloadDigestBusyUs(void)
+{
+    return (uint32_t)k_cyc_to_us_floor64(busy_cyc);
+}
@@ -0,0 +1,161 @@
+/*
+ * Copyright (c) 2023 SAKURA internet Inc.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+
+#include "app_mem.h"
+#include "download_inflate.h"
+
+#define WINDOW_SZ2 (CONFIG_APP_DOWNLOAD_INFLATE_WINDOW_SZ2)
+#define LOOKAHEAD_SZ2 (CONFIG_APP_DOWNLOAD_INFLATE_LOOKAHEAD_SZ2)
+#define WINDOW_SZ (1U << WINDOW_SZ2)
+#define WINDOW_MASK (WINDOW_SZ - 1)
+
+BUILD_ASSERT(LOOKAHEAD_SZ2 < WINDOW_SZ2, "lookahead must be smaller than the window");
+
+enum inflate_state {
+    INFLATE_TAG,     /* 1: literal, 0: back-reference */
+    INFLATE_LITERAL, /* 8 bits */
+    INFLATE_INDEX,   /* WINDOW_SZ2 bits, distance - 1 */
+    INFLATE_COUNT,   /* LOOKAHEAD_SZ2 bits, length - 1 */
+};
+
+/* 展開済みデータの窓。出力もここから直接渡す */
+static uint8_t *window; /* WINDOW_SZ, from the arena on first use */
+static uint32_t head;    /* 展開したバイト数 */
+static uint32_t pending; /* まだ出力していないバイト数(窓の末尾で折り返す前に出す) */
+static uint32_t backref;
+static enum inflate_state state;
+static uint32_t bits;
+static int bit_cnt;
+static download_inflate_out_t out_cb;
+
+/* MSB first. Returns false when the chunk ends before `n` bits are available */
+static bool inflate_get_bits(const uint8_t **p, const uint8_t *end, int n, uint32_t *v)
+{
+    while (bit_cnt < n) {
+        if (*p == end) {
+            return false;
+        }
+        bits = (bits << 8) | *(*p)++;
+        bit_cnt += 8;
+    }
+    bit_cnt -= n;
+    *v = (bits >> bit_cnt) & ((1U << n) - 1);
+    return true;
+}
+
+static int inflate_flush(void)
+{
+    uint32_t start = (head - pending) & WINDOW_MASK;
+    uint32_t n = pending;
+
+    pending = 0;
+    return (n > 0) ? out_cb(&window[start], n) : 0;
+}
+
+static int inflate_put(uint8_t c)
+{
+    window[head & WINDOW_MASK] = c;
+    head++;
+    pending++;
+    // 窓の末尾まで埋まったら上書きする前に出力する
+    if ((head & WINDOW_MASK) == 0) {
+        return inflate_flush();
+    }
+    return 0;
+}
+
+bool DownloadInflateMatch(const char *file_id)
+{
+    const char *suffix = CONFIG_APP_DOWNLOAD_INFLATE_SUFFIX;
+    size_t len = strlen(file_id);
+    size_t slen = strlen(suffix);
+
+    return (slen > 0) && (len > slen) && (strcmp(&file_id[len - slen], suffix) == 0);
+}
+
+int DownloadInflateBegin(download_inflate_out_t out)
+{
+    if (window == NULL) {
+        window = AppArenaAlloc(WINDOW_SZ, "inflate window");
+        if (window == NULL) {
+            return -ENOMEM;
+        }
+    }
+    // heatshrinkのデコーダと同じく窓の初期値は0
+    memset(window, 0, WINDOW_SZ);
+    head = 0;
+    pending = 0;
+    state = INFLATE_TAG;
+    bits = 0;
+    bit_cnt = 0;
+    out_cb = out;
+    return 0;
+}
+
+int DownloadInflateWrite(const uint8_t *data, size_t len)
+{
+    const uint8_t *end = data + len;
+    uint32_t v;
+    int err;
+
+    for (;;) {
+        switch (state) {
+        case INFLATE_TAG:
+            if (!inflate_get_bits(&data, end, 1, &v)) {
+                return inflate_flush();
+            }
+            state = v ? INFLATE_LITERAL : INFLATE_INDEX;
+            break;
+        case INFLATE_LITERAL:
+            if (!inflate_get_bits(&data, end, 8, &v)) {
+                return inflate_flush();
+            }
+            err = inflate_put((uint8_t)v);
+            if (err) {
+                return err;
+            }
+            state = INFLATE_TAG;
+            break;
+        case INFLATE_INDEX:
+            if (!inflate_get_bits(&data, end, WINDOW_SZ2, &v)) {
+                return inflate_flush();
+            }
+            backref = v + 1;
+            state = INFLATE_COUNT;
+            break;
+        case INFLATE_COUNT:
+            if (!inflate_get_bits(&data, end, LOOKAHEAD_SZ2, &v)) {
+                return inflate_flush();
+            }
+            // 参照先は窓の中にあるので1バイトずつコピーする(重なりを許す)
+            for (uint32_t i = 0; i <= v; i++) {
+                err = inflate_put(window[(head - backref) & WINDOW_MASK]);
+                if (err) {
+                    return err;
+                }
+            }
+            state = INFLATE_TAG;
+            break;
+        }
+    }
+}
+
+uint32_t DownloadInflateEnd(void)
+{
+    /*
+     * The encoder pads the last byte with zero bits, which decode as the
+     * start of a back-reference that never completes; the remaining state
+     * is simply dropped.
+     */
+    state = INFLATE_TAG;
+    bit_cnt = 0;
+    return head;
+}
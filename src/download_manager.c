@@ -0,0 +1,559 @@
+/*
+ * Copyright (c) 2023 SAKURA internet Inc.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/atomic.h>
+
+#include "sipf/sipf_file.h"
+#include "auth_cache.h"
+#include "download_cache.h"
+#include "download_digest.h"
+#include "download_manager.h"
+#include "download_pipeline.h"
+#include "download_stats.h"
+#include "fota.h"
+#include "hex_encode.h"
+#include "lte_conn.h"
+#include "uart_broker.h"
+
+LOG_MODULE_DECLARE(sipf, CONFIG_SIPF_LOG_LEVEL);
+
+#define PRIORITY (CONFIG_APP_DOWNLOAD_MANAGER_THREAD_PRIORITY)
+#define QUEUE_DEPTH (CONFIG_APP_DOWNLOAD_MANAGER_QUEUE_DEPTH)
+#define BATCH_WINDOW_MS (CONFIG_APP_DOWNLOAD_BATCH_WINDOW_MS)
+#define RRC_CURRENT_UA (CONFIG_APP_ENERGY_RRC_CURRENT_UA)
+#define RRC_TAIL_MAX_MS (60000)
+#define RRC_TAIL_POLL_MS (1000)
+#define NETWORK_WAIT_MS ((int64_t)CONFIG_APP_DOWNLOAD_NETWORK_WAIT_S * MSEC_PER_SEC)
+#define NETWORK_POLL_MS (1000)
+
+/*
+ * SipfFileDownload() (HTTP client + TLS socket) runs on this thread, so the
+ * stack is sized from what the NCS download client thread needs plus the
+ * SIPF client and the download callback on top of it.
+ */
+#if defined(CONFIG_DOWNLOAD_CLIENT_STACK_SIZE)
+#define STACK_DM_SZ (CONFIG_DOWNLOAD_CLIENT_STACK_SIZE + CONFIG_APP_DOWNLOAD_MANAGER_STACK_EXTRA)
+#else
+#define STACK_DM_SZ (4096 + CONFIG_APP_DOWNLOAD_MANAGER_STACK_EXTRA)
+#endif
+
+enum dm_req_type {
+    DM_REQ_DOWNLOAD,
+    DM_REQ_UPLOAD_STATS,
+};
+
+struct dm_req {
+    uint8_t type;
+    int8_t mode; /* DM_REQ_DOWNLOAD: enum download_output_mode, -1: the default mode */
+    bool has_digest;
+    bool image; /* stream into the MCUboot secondary slot (CONFIG_APP_FOTA) */
+    char file_id[DOWNLOAD_FILE_ID_MAX];
+    int64_t submit_ms; /* k_uptime_get() at submit */
+    atomic_val_t gen;  /* dm_gen at submit */
+#if defined(CONFIG_APP_DOWNLOAD_DIGEST)
+    uint8_t digest[DOWNLOAD_DIGEST_SZ]; /* expected value when has_digest */
+#endif
+};
+
+#define DM_MODE_KEEP (DOWNLOAD_MANAGER_MODE_KEEP)
+
+K_MSGQ_DEFINE(msgq_dm, sizeof(struct dm_req), QUEUE_DEPTH, 4);
+
+K_THREAD_STACK_DEFINE(stack_dm, STACK_DM_SZ);
+static struct k_thread thread_dm;
+static k_tid_t tid_dm;
+
+static atomic_t dm_running;
+/* DownloadManagerAbort()のたびに進める(これより前に受け付けた要求は中断) */
+static atomic_t dm_gen;
+static download_manager_done_cb_t done_cb;
+/* 実行中の要求(パイプラインがダウンロード終了まで file_id を参照する) */
+static struct dm_req cur_req;
+
+/**
+ * ファイルダウンロードのコールバック関数
+*/
+static int pipeline_write(uint8_t *buff, size_t len)
+{
+    // シンク(UART出力/フラッシュ保存)のスレッドへ渡してすぐ戻る
+    return DownloadPipelineWrite(buff, len);
+}
+
+static bool download_manager_aborted(void)
+{
+    return cur_req.gen != atomic_get(&dm_gen);
+}
+
+static int cb_fileDownload(uint8_t *buff, size_t len)
+{
+    if (download_manager_aborted()) {
+        return -ECANCELED;
+    }
+    return DownloadStatsCallback(pipeline_write, buff, len);
+}
+
+#if defined(CONFIG_APP_DOWNLOAD_DIGEST_SIDECAR)
+/* "<hex digest>[ <file name>]" as written by sha256sum/crc32 */
+static char sidecar[DOWNLOAD_DIGEST_SZ * 2 + DOWNLOAD_FILE_ID_MAX + 8];
+static size_t sidecar_len;
+
+static int cb_sidecar(uint8_t *buff, size_t len)
+{
+    size_t n = MIN(len, sizeof(sidecar) - 1 - sidecar_len);
+
+    memcpy(&sidecar[sidecar_len], buff, n);
+    sidecar_len += n;
+    return 0;
+}
+
+/* Fetch the expected digest of `file_id` from "<file_id><suffix>" */
+static int download_manager_sidecar(const char *file_id, uint8_t *digest)
+{
+    char id[DOWNLOAD_FILE_ID_MAX + sizeof(CONFIG_APP_DOWNLOAD_DIGEST_SUFFIX)];
+    int ret;
+
+    snprintf(id, sizeof(id), "%s%s", file_id, CONFIG_APP_DOWNLOAD_DIGEST_SUFFIX);
+    sidecar_len = 0;
+    ret = SipfFileDownload(id, NULL, sizeof(sidecar), cb_sidecar);
+    if (ret < 0) {
+        return ret;
+    }
+    sidecar[sidecar_len] = '\0';
+    if ((sidecar_len < DOWNLOAD_DIGEST_SZ * 2) || (HexDecode(digest, sidecar, DOWNLOAD_DIGEST_SZ) != 0)) {
+        return -EBADMSG;
+    }
+    return 0;
+}
+#endif
+
+#if defined(CONFIG_APP_DOWNLOAD_CACHE)
+/*
+ * If the stored copy of the file is current, write it to the UART instead
+ * of downloading it and return its size; -ENOENT otherwise. `digest` is the
+ * server's value of the file (the request's or the sidecar's); with NULL
+ * the copy is current only within APP_DOWNLOAD_CACHE_MAX_AGE_S. `checked`:
+ * `digest` was just read from the server (sidecar), which restarts that time.
+ */
+static int download_manager_cached(const struct dm_req *req, const uint8_t *digest, bool checked)
+{
+    struct download_cache_entry ent;
+    int ret;
+
+    if (req->image || (DownloadCacheLookup(req->file_id, &ent) != 0)) {
+        return -ENOENT;
+    }
+    if (digest != NULL) {
+        if (memcmp(digest, ent.digest, sizeof(ent.digest)) != 0) {
+            return -ENOENT;
+        }
+    } else if (!DownloadCacheFresh(req->file_id)) {
+        return -ENOENT;
+    }
+    if (DownloadCacheVerify(&ent) != 0) {
+        // フラッシュのコピーがもうない
+        return -ENOENT;
+    }
+    DownloadCacheTouch(req->file_id, checked);
+    DownloadSinkSetNextMode(req->mode);
+    ret = DownloadSinkReplay(req->file_id, ent.size);
+    if (ret < 0) {
+        UartBrokerPuts("FAILED\r\n");
+        return ret;
+    }
+    UartBrokerPrintf("Not modified: %d bytes (cached).\r\n", ret);
+    return ret;
+}
+
+static void download_manager_cache_update(const struct dm_req *req, int result)
+{
+    struct download_cache_entry ent = {0};
+    uint32_t size;
+
+    if (req->image || (result < 0) || (DownloadSinkGetDigest(ent.digest) != 0)) {
+        return;
+    }
+    strncpy(ent.file_id, req->file_id, sizeof(ent.file_id) - 1);
+    ent.size = result;
+    ent.loc = DOWNLOAD_CACHE_LOC_NONE;
+    if (DownloadSinkGetStored(&size, &ent.crc) == 0) {
+        ent.size = size;
+        ent.loc = DOWNLOAD_CACHE_LOC_FLASH;
+    }
+    DownloadCacheUpdate(&ent);
+}
+#endif
+
+/* Charge [nAh] of rrc_ms in RRC connected mode at RRC_CURRENT_UA */
+static uint32_t download_manager_nah(uint64_t rrc_ms)
+{
+    return (uint32_t)((uint64_t)RRC_CURRENT_UA * rrc_ms / 3600);
+}
+
+static void download_manager_energy(const char *what, uint64_t rrc_ms, uint32_t bytes)
+{
+    uint32_t nah = download_manager_nah(rrc_ms);
+    uint32_t per_kb = (bytes > 0) ? (uint32_t)((uint64_t)nah * 1024 / bytes) : 0;
+
+    UartBrokerPrintf("%s: RRC %u ms, %u.%03u uAh, %u.%03u uAh/KB\r\n", what, (uint32_t)rrc_ms, nah / 1000, nah % 1000, per_kb / 1000, per_kb % 1000);
+}
+
+/* 回線が切れている場合は再接続を待つ($ABORTか、要求から一定時間で諦める) */
+static int download_manager_wait_network(const struct dm_req *req)
+{
+    bool waiting = false;
+
+    while (LteConnWait(NETWORK_POLL_MS) != 0) {
+        if (download_manager_aborted()) {
+            return -ECANCELED;
+        }
+        if ((NETWORK_WAIT_MS > 0) && ((k_uptime_get() - req->submit_ms) >= NETWORK_WAIT_MS)) {
+            return -ENETUNREACH;
+        }
+        if (LteConnGetState() == LTE_CONN_IDLE) {
+            return -ENETUNREACH;
+        }
+        if (!waiting) {
+            UartBrokerPuts("Waiting for the network...\r\n");
+            waiting = true;
+        }
+    }
+    return 0;
+}
+
+static int download_manager_run(const struct dm_req *req, uint32_t *ttfb_ms, uint32_t *bytes)
+{
+    const char *file_id = req->file_id;
+    uint64_t rrc_ms;
+    struct download_pipeline_stats st;
+    int recv_len;
+    int err;
+
+    UartBrokerPrintf("Download %s\r\n", file_id);
+    *ttfb_ms = 0;
+    *bytes = 0;
+    if (download_manager_aborted()) {
+        // 取り出した直後に$ABORTされた
+        UartBrokerPuts("CANCELED\r\n");
+        return -ECANCELED;
+    }
+#if defined(CONFIG_APP_DOWNLOAD_CACHE)
+    // 要求に期待値がある、または照合したばかりなら通信しない
+    recv_len = download_manager_cached(req, req->has_digest ? req->digest : NULL, false);
+    if (recv_len != -ENOENT) {
+        return recv_len;
+    }
+#endif
+#if defined(CONFIG_APP_FOTA)
+    // 保存すると再起動待ちのイメージを壊すので通信する前に断る
+    if (!req->image && DownloadSinkGetStore() && (FotaCheckFileStore() != 0)) {
+        UartBrokerPuts("FAILED (update pending)\r\n");
+        return -EBUSY;
+    }
+#endif
+    err = download_manager_wait_network(req);
+    if (err) {
+        UartBrokerPuts((err == -ECANCELED) ? "CANCELED\r\n" : "FAILED (no network)\r\n");
+        return err;
+    }
+#if defined(CONFIG_APP_DOWNLOAD_DIGEST)
+    if (req->has_digest) {
+        DownloadSinkSetDigest(req->digest);
+    } else {
+#if defined(CONFIG_APP_DOWNLOAD_DIGEST_SIDECAR)
+        uint8_t digest[DOWNLOAD_DIGEST_SZ];
+        err = download_manager_sidecar(file_id, digest);
+        if (err) {
+            LOG_WRN("%s: no %s%s (%d), not verified", file_id, file_id, CONFIG_APP_DOWNLOAD_DIGEST_SUFFIX, err);
+        }
+#if defined(CONFIG_APP_DOWNLOAD_CACHE)
+        if (err == 0) {
+            // サーバのファイルが変わっていなければ本体は取りに行かない
+            recv_len = download_manager_cached(req, digest, true);
+            if (recv_len != -ENOENT) {
+                return recv_len;
+            }
+        }
+#endif
+        DownloadSinkSetDigest((err == 0) ? digest : NULL);
+#else
+        DownloadSinkSetDigest(NULL);
+#endif
+    }
+#endif
+#if defined(CONFIG_APP_FOTA)
+    DownloadSinkSetImage(req->image);
+#endif
+    // 要求で指定した出力モードはこのファイル限り
+    DownloadSinkSetNextMode(req->mode);
+    rrc_ms = LteConnRrcConnectedMs();
+    DownloadStatsBegin(file_id);
+    DownloadPipelineBegin(file_id);
+    recv_len = SipfFileDownload(file_id, NULL, DownloadPipelineChunkSize(), cb_fileDownload);
+    err = DownloadPipelineEnd(recv_len);
+    if ((recv_len >= 0) && (err < 0)) {
+        recv_len = err;
+    }
+    DownloadStatsEnd(recv_len);
+#if defined(CONFIG_APP_DOWNLOAD_CACHE)
+    download_manager_cache_update(req, recv_len);
+#endif
+    if (recv_len < 0) {
+        UartBrokerPuts("FAILED\r\n");
+    } else {
+        UartBrokerPrintf("Received: %d bytes.\r\n", recv_len);
+    }
+    DownloadPipelineGetStats(&st);
+    LOG_INF("%s: TTFB %u ms, %u bytes in %u ms", file_id, st.ttfb_ms, st.bytes, st.elapsed_ms);
+    download_manager_energy(file_id, LteConnRrcConnectedMs() - rrc_ms, st.bytes);
+    *ttfb_ms = st.ttfb_ms;
+    *bytes = st.bytes;
+    return recv_len;
+}
+
+/*
+ * バッチの後、RRCが解放されるまでの時間も含めて1回分の接続コストとする。
+ * 解放はシステムワークキューで待ち、ダウンロードマネージャは次の要求へ進む。
+ */
+static struct {
+    bool pending;
+    uint64_t rrc_ms; /* LteConnRrcConnectedMs() at the start of the batch */
+    uint32_t bytes;
+    int64_t deadline;
+} tail;
+static struct k_spinlock lock_tail;
+
+static void download_manager_tail_fn(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(work_tail, download_manager_tail_fn);
+
+/* force: 次のバッチが始まるので解放を待たずに出力する */
+static void download_manager_tail_report(bool force)
+{
+    bool idle = (LteConnWaitRrcIdle(0) == 0);
+    uint64_t rrc_now = LteConnRrcConnectedMs();
+    k_spinlock_key_t key = k_spin_lock(&lock_tail);
+    bool pending = tail.pending;
+    bool done = pending && (force || idle || (k_uptime_get() >= tail.deadline));
+    uint64_t rrc_ms = rrc_now - tail.rrc_ms;
+    uint32_t bytes = tail.bytes;
+
+    if (done) {
+        tail.pending = false;
+    }
+    k_spin_unlock(&lock_tail, key);
+    if (done) {
+        download_manager_energy("Batch", rrc_ms, bytes);
+    } else if (pending) {
+        k_work_reschedule(&work_tail, K_MSEC(RRC_TAIL_POLL_MS));
+    }
+}
+
+static void download_manager_tail_fn(struct k_work *work)
+{
+    download_manager_tail_report(false);
+}
+
+static void download_manager_tail_start(uint64_t rrc_ms, uint32_t bytes)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock_tail);
+
+    tail.rrc_ms = rrc_ms;
+    tail.bytes = bytes;
+    tail.deadline = k_uptime_get() + RRC_TAIL_MAX_MS;
+    tail.pending = true;
+    k_spin_unlock(&lock_tail, key);
+    k_work_reschedule(&work_tail, K_NO_WAIT);
+}
+
+static void download_manager_thread(void *arg1, void *arg2, void *arg3)
+{
+    for (;;) {
+        uint32_t files = 0;
+        uint32_t failed = 0;
+        uint32_t ttfb_first = 0;
+        uint32_t ttfb_rest = 0;
+        uint32_t ttfb;
+        uint32_t bytes;
+        uint32_t batch_bytes = 0;
+        uint64_t rrc_ms;
+        int64_t ms_begin;
+        int64_t ms_end;
+
+        k_msgq_get(&msgq_dm, &cur_req, K_FOREVER);
+        atomic_set(&dm_running, 1);
+#if defined(CONFIG_APP_DOWNLOAD_PSM_SCHEDULE)
+        /*
+         * Waking the modem from PSM just for this request costs a whole
+         * extra RRC connection. Hold the batch until the modem wakes up on
+         * its own (TAU, other traffic) and collect every request submitted
+         * meanwhile, so they share one active window.
+         */
+        if (LteConnWaitAwake(0) != 0) {
+            LOG_INF("Modem in PSM, defer downloads up to %d ms", CONFIG_APP_DOWNLOAD_PSM_MAX_DEFER_MS);
+            LteConnWaitAwake(CONFIG_APP_DOWNLOAD_PSM_MAX_DEFER_MS);
+        }
+#endif
+        download_manager_tail_report(true);
+        ms_begin = k_uptime_get();
+        ms_end = ms_begin;
+        rrc_ms = LteConnRrcConnectedMs();
+        /*
+         * Requests submitted within BATCH_WINDOW_MS of the previous one are
+         * reported as one batch. SipfFileDownload() opens its own socket and
+         * TLS session for every file, so nothing is reused between them; the
+         * batch log only compares their time to first byte.
+         */
+        do {
+            atomic_set(&dm_running, 1);
+            if (cur_req.type == DM_REQ_UPLOAD_STATS) {
+                int ret = DownloadStatsUpload();
+                UartBrokerPrintf("Upload stats: %d\r\n", ret);
+                atomic_set(&dm_running, 0);
+                continue;
+            }
+            int ret = download_manager_run(&cur_req, &ttfb, &bytes);
+            if ((ret < 0) && !download_manager_aborted() && (AuthCacheRecover(ret) == 0)) {
+                // 認証情報を取り直したので1回だけやり直す
+                ret = download_manager_run(&cur_req, &ttfb, &bytes);
+            }
+            if (done_cb != NULL) {
+                done_cb(cur_req.file_id, ret);
+            }
+            if (ret < 0) {
+                failed++;
+            } else {
+                AuthCacheConfirm();
+#if defined(CONFIG_APP_DOWNLOAD_STATS_UPLOAD)
+                DownloadStatsUpload();
+#endif
+            }
+            batch_bytes += bytes;
+            if (files == 0) {
+                ttfb_first = ttfb;
+            } else {
+                ttfb_rest += ttfb;
+            }
+            files++;
+            atomic_set(&dm_running, 0);
+            ms_end = k_uptime_get();
+        } while (k_msgq_get(&msgq_dm, &cur_req, K_MSEC(BATCH_WINDOW_MS)) == 0);
+
+        // 最後のダウンロードが終わるまでの時間(待ち受け時間は含めない)
+        LOG_INF("Download batch: %u files, %u failed, %lld ms, TTFB first %u ms, rest avg %u ms", files, failed, ms_end - ms_begin, ttfb_first,
+                (files > 1) ? ttfb_rest / (files - 1) : 0);
+        download_manager_tail_start(rrc_ms, batch_bytes);
+        struct uart_broker_activity act;
+        UartBrokerGetActivity(&act);
+        LOG_DBG("UartBroker: wakeups=%u active=%llu us idle=%llu us", act.wakeups, act.active_us, act.idle_us);
+    }
+}
+
+static int download_manager_submit(const char *file_id, int mode, const uint8_t *digest, bool image)
+{
+    struct dm_req req;
+    int err;
+
+    if ((file_id == NULL) || (file_id[0] == '\0')) {
+        return -EINVAL;
+    }
+    req.type = DM_REQ_DOWNLOAD;
+    req.mode = mode;
+    req.image = image;
+    req.has_digest = (digest != NULL);
+    if (req.has_digest) {
+#if defined(CONFIG_APP_DOWNLOAD_DIGEST)
+        memcpy(req.digest, digest, sizeof(req.digest));
+#else
+        return -ENOTSUP;
+#endif
+    }
+    strncpy(req.file_id, file_id, sizeof(req.file_id) - 1);
+    req.file_id[sizeof(req.file_id) - 1] = '\0';
+    req.submit_ms = k_uptime_get();
+    req.gen = atomic_get(&dm_gen);
+
+    err = k_msgq_put(&msgq_dm, &req, K_NO_WAIT);
+    if (err) {
+        return -ENOMEM;
+    }
+    return k_msgq_num_used_get(&msgq_dm);
+}
+
+/** Interface **/
+
+int DownloadManagerSubmit(const char *file_id)
+{
+    return DownloadManagerSubmitDigest(file_id, DOWNLOAD_MANAGER_MODE_KEEP, NULL);
+}
+
+int DownloadManagerSubmitMode(const char *file_id, enum download_output_mode mode)
+{
+    return DownloadManagerSubmitDigest(file_id, mode, NULL);
+}
+
+int DownloadManagerSubmitDigest(const char *file_id, int mode, const uint8_t *digest)
+{
+    return download_manager_submit(file_id, mode, digest, false);
+}
+
+int DownloadManagerSubmitImage(const char *file_id, const uint8_t *digest)
+{
+#if defined(CONFIG_APP_FOTA)
+    return download_manager_submit(file_id, DM_MODE_KEEP, digest, true);
+#else
+    return -ENOTSUP;
+#endif
+}
+
+int DownloadManagerSubmitStatsUpload(void)
+{
+    struct dm_req req = {.type = DM_REQ_UPLOAD_STATS, .gen = atomic_get(&dm_gen)};
+
+    if (k_msgq_put(&msgq_dm, &req, K_NO_WAIT) != 0) {
+        return -ENOMEM;
+    }
+    return k_msgq_num_used_get(&msgq_dm);
+}
+
+int DownloadManagerQueued(void)
+{
+    return k_msgq_num_used_get(&msgq_dm);
+}
+
+int DownloadManagerAbort(void)
+{
+    int n = k_msgq_num_used_get(&msgq_dm);
+
+    atomic_inc(&dm_gen);
+    k_msgq_purge(&msgq_dm);
+    return n;
+}
+
+void DownloadManagerSetDoneCallback(download_manager_done_cb_t cb)
+{
+    done_cb = cb;
+}
+
+bool DownloadManagerBusy(void)
+{
+    return (atomic_get(&dm_running) != 0) || (k_msgq_num_used_get(&msgq_dm) > 0);
+}
+
+int DownloadManagerInit(void)
+{
+    DownloadStatsInit();
+#if defined(CONFIG_APP_DOWNLOAD_DIGEST)
+    DownloadDigestInit();
+#endif
+    tid_dm = k_thread_create(&thread_dm, stack_dm, STACK_DM_SZ, download_manager_thread, NULL, NULL, NULL, PRIORITY, 0, K_NO_WAIT);
+    k_thread_name_set(tid_dm, "download manager");
+    return 0;
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2023 SAKURA internet Inc.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/settings/settings.h>
+
+#include "download_manifest.h"
+
+LOG_MODULE_DECLARE(sipf, CONFIG_SIPF_LOG_LEVEL);
+
+#define KEY_MFST "mfst/m"
+#define MFST_HDR_SZ (offsetof(struct download_manifest, block_crc))
+
+struct manifest_load {
+    struct download_manifest *mf;
+    bool found;
+};
+
+/* 保存済みのマニフェストがあるか(起動直後は不明なのであるものとする) */
+static bool mfst_present = true;
+
+/* 呼び出し元のバッファに直接読み込む(マニフェストのコピーを常駐させない) */
+static int download_manifest_load_cb(const char *key, size_t len, settings_read_cb read_cb, void *cb_arg, void *param)
+{
+    struct manifest_load *ld = param;
+    const char *next;
+
+    if (!settings_name_steq(key, "m", &next) || (next != NULL)) {
+        return 0;
+    }
+    if ((len < MFST_HDR_SZ) || (len > sizeof(*ld->mf))) {
+        return -EINVAL;
+    }
+    if (read_cb(cb_arg, ld->mf, len) != (ssize_t)len) {
+        return -EIO;
+    }
+    mfst_present = true;
+    ld->mf->file_id[sizeof(ld->mf->file_id) - 1] = '\0';
+    ld->found = (len == MFST_HDR_SZ + ld->mf->count * sizeof(uint32_t));
+    return 0;
+}
+
+int DownloadManifestInit(void)
+{
+    int err = settings_subsys_init();
+    if (err) {
+        LOG_ERR("settings_subsys_init() failed: %d", err);
+        return err;
+    }
+    return 0;
+}
+
+int DownloadManifestLoad(const char *file_id, struct download_manifest *mf)
+{
+    struct manifest_load ld = {.mf = mf};
+    int err;
+
+    mfst_present = false;
+    err = settings_load_subtree_direct("mfst", download_manifest_load_cb, &ld);
+    if (err) {
+        mfst_present = true;
+        return err;
+    }
+    if (!ld.found || (strncmp(mf->file_id, file_id, sizeof(mf->file_id)) != 0)) {
+        return -ENOENT;
+    }
+    if ((mf->block_size != CONFIG_APP_FLASH_SINK_BUF_SIZE) || (mf->count > DOWNLOAD_MANIFEST_MAX_BLOCKS)) {
+        // ブロックサイズを変えたビルドでは使えない
+        return -ENOENT;
+    }
+    return 0;
+}
+
+int DownloadManifestSave(const struct download_manifest *mf)
+{
+    int err;
+
+    if (mf->count > DOWNLOAD_MANIFEST_MAX_BLOCKS) {
+        return -EINVAL;
+    }
+    err = settings_save_one(KEY_MFST, mf, MFST_HDR_SZ + mf->count * sizeof(uint32_t));
+    if (err) {
+        LOG_ERR("settings_save_one(%s) failed: %d", KEY_MFST, err);
+        return err;
+    }
+    mfst_present = true;
+    LOG_DBG("manifest: %s %u bytes, %u blocks", mf->file_id, mf->size, mf->count);
+    return 0;
+}
+
+int DownloadManifestClear(void)
+{
+    if (!mfst_present) {
+        return 0;
+    }
+    mfst_present = false;
+    return settings_delete(KEY_MFST);
+}
@@ -0,0 +1,264 @@
+/*
+ * Copyright (c) 2023 SAKURA internet Inc.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/atomic.h>
+
+#include "app_trace.h"
+#include "download_pipeline.h"
+#include "download_sink.h"
+
+LOG_MODULE_DECLARE(sipf, CONFIG_SIPF_LOG_LEVEL);
+
+static struct download_pipeline_stats stats;
+static int64_t ms_begin;
+
+/* sz_download of the next SipfFileDownload() */
+#if defined(CONFIG_APP_DOWNLOAD_CHUNK_ADAPTIVE)
+#define CHUNK_MIN (CONFIG_APP_DOWNLOAD_CHUNK_MIN_SIZE)
+BUILD_ASSERT(CHUNK_MIN <= DOWNLOAD_CHUNK_SZ, "APP_DOWNLOAD_CHUNK_MIN_SIZE must not exceed APP_DOWNLOAD_CHUNK_SIZE");
+static size_t chunk_sz = CHUNK_MIN;
+static uint32_t last_bps;
+#else
+static size_t chunk_sz = DOWNLOAD_CHUNK_SZ;
+#endif
+
+#if defined(CONFIG_APP_DOWNLOAD_PIPELINE)
+
+#define PRIORITY (CONFIG_APP_DOWNLOAD_PIPELINE_THREAD_PRIORITY)
+#define STACK_DP_SZ (CONFIG_APP_DOWNLOAD_PIPELINE_STACK_SIZE)
+#define BUF_NUM (CONFIG_APP_DOWNLOAD_PIPELINE_BUF_COUNT)
+
+enum dl_msg_type {
+    DL_MSG_BEGIN,
+    DL_MSG_DATA,
+    DL_MSG_END,
+};
+
+struct dl_msg {
+    uint8_t type;
+    int32_t val;          /* DATA: length, END: result */
+    void *buf;            /* DATA: block from slab_dp */
+    const char *file_id; /* BEGIN */
+};
+
+/* BUF_NUM * DOWNLOAD_CHUNK_SZ, from the arena */
+static struct k_mem_slab slab_dp;
+/* バッファ数 + BEGIN/END の分 */
+K_MSGQ_DEFINE(msgq_dp, sizeof(struct dl_msg), BUF_NUM + 2, 4);
+static K_SEM_DEFINE(sem_dp_done, 0, 1);
+
+K_THREAD_STACK_DEFINE(stack_dp, STACK_DP_SZ);
+static struct k_thread thread_dp;
+static k_tid_t tid_dp;
+
+static atomic_t sink_err;
+static int end_result;
+
+static void download_pipeline_thread(void *arg1, void *arg2, void *arg3)
+{
+    struct dl_msg msg;
+    int err;
+
+    for (;;) {
+        k_msgq_get(&msgq_dp, &msg, K_FOREVER);
+        switch (msg.type) {
+        case DL_MSG_BEGIN:
+            err = DownloadSinkBegin(msg.file_id);
+            atomic_set(&sink_err, err);
+            break;
+        case DL_MSG_DATA:
+            if (atomic_get(&sink_err) == 0) {
+                err = DownloadSinkWrite(msg.buf, msg.val);
+                if (err) {
+                    LOG_ERR("DownloadSinkWrite() failed: %d", err);
+                    atomic_set(&sink_err, err);
+                }
+                APP_TRACE(APP_TRACE_DL_SINK, msg.val, err);
+            }
+            k_mem_slab_free(&slab_dp, &msg.buf);
+            break;
+        case DL_MSG_END:
+            // シンクのエラーを優先して返す
+            err = atomic_get(&sink_err);
+            end_result = DownloadSinkEnd(((err != 0) && (msg.val >= 0)) ? err : msg.val);
+            k_sem_give(&sem_dp_done);
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+static int pipeline_init(void)
+{
+    void *pool = AppArenaAlloc(DOWNLOAD_PIPELINE_ARENA_SZ, "download pool");
+    int err;
+
+    if (pool == NULL) {
+        return -ENOMEM;
+    }
+    err = k_mem_slab_init(&slab_dp, pool, DOWNLOAD_CHUNK_SZ, BUF_NUM);
+    if (err) {
+        return err;
+    }
+    tid_dp = k_thread_create(&thread_dp, stack_dp, STACK_DP_SZ, download_pipeline_thread, NULL, NULL, NULL, PRIORITY, 0, K_NO_WAIT);
+    k_thread_name_set(tid_dp, "download sink");
+    return 0;
+}
+
+static int pipeline_begin(const char *file_id)
+{
+    struct dl_msg msg = {.type = DL_MSG_BEGIN, .file_id = file_id};
+
+    atomic_set(&sink_err, 0);
+    return k_msgq_put(&msgq_dp, &msg, K_FOREVER);
+}
+
+static int pipeline_write(const uint8_t *data, size_t len)
+{
+    struct dl_msg msg = {.type = DL_MSG_DATA};
+    int err;
+
+    while (len > 0) {
+        err = atomic_get(&sink_err);
+        if (err) {
+            return err;
+        }
+        err = k_mem_slab_alloc(&slab_dp, &msg.buf, K_NO_WAIT);
+        if (err) {
+            // 空きバッファが無ければシンクが追いつくまで待つ
+            int64_t t = k_uptime_get();
+            stats.stalls++;
+            err = k_mem_slab_alloc(&slab_dp, &msg.buf, K_FOREVER);
+            t = k_uptime_get() - t;
+            stats.stall_ms += t;
+            APP_TRACE(APP_TRACE_DL_STALL, 0, t);
+            if (err) {
+                return err;
+            }
+        }
+        msg.val = MIN(len, DOWNLOAD_CHUNK_SZ);
+        memcpy(msg.buf, data, msg.val);
+        k_msgq_put(&msgq_dp, &msg, K_FOREVER);
+        data += msg.val;
+        len -= msg.val;
+    }
+    return 0;
+}
+
+static int pipeline_end(int result)
+{
+    struct dl_msg msg = {.type = DL_MSG_END, .val = result};
+
+    k_msgq_put(&msgq_dp, &msg, K_FOREVER);
+    k_sem_take(&sem_dp_done, K_FOREVER);
+    return end_result;
+}
+
+#else
+
+static int pipeline_init(void)
+{
+    return 0;
+}
+
+static int pipeline_begin(const char *file_id)
+{
+    return DownloadSinkBegin(file_id);
+}
+
+static int pipeline_write(const uint8_t *data, size_t len)
+{
+    return DownloadSinkWrite(data, len);
+}
+
+static int pipeline_end(int result)
+{
+    return DownloadSinkEnd(result);
+}
+
+#endif
+
+#if defined(CONFIG_APP_DOWNLOAD_CHUNK_ADAPTIVE)
+/*
+ * Pick the chunk size of the next download: keep doubling while throughput
+ * improves and step back when it drops. Every pool block is DOWNLOAD_CHUNK_SZ
+ * whatever the chunk size, so a smaller chunk frees no memory and only holds
+ * fewer bytes in the pool. When the sink could not keep up (stalls) the
+ * throughput says nothing about the network and the size is kept.
+ */
+static void chunk_adapt(int result, int64_t ms)
+{
+    size_t prev = chunk_sz;
+    uint32_t bps;
+
+    // 少なすぎるサンプルでは判断しない
+    if ((result < 0) || (stats.bytes < 2 * chunk_sz) || (ms <= 0)) {
+        return;
+    }
+    bps = (uint32_t)((uint64_t)stats.bytes * MSEC_PER_SEC / ms);
+    if (stats.stalls > 0) {
+        // シンク側が律速しているので変えない
+    } else if (bps >= last_bps) {
+        chunk_sz = MIN(chunk_sz * 2, DOWNLOAD_CHUNK_SZ);
+    } else {
+        chunk_sz = MAX(chunk_sz / 2, CHUNK_MIN);
+    }
+    last_bps = bps;
+    LOG_DBG("chunk: %u B/s, stalls=%u -> %u bytes (was %u)", bps, stats.stalls, (unsigned int)chunk_sz, (unsigned int)prev);
+}
+#endif
+
+int DownloadPipelineInit(void)
+{
+    return pipeline_init();
+}
+
+size_t DownloadPipelineChunkSize(void)
+{
+    return chunk_sz;
+}
+
+void DownloadPipelineGetStats(struct download_pipeline_stats *st)
+{
+    *st = stats;
+}
+
+int DownloadPipelineBegin(const char *file_id)
+{
+    memset(&stats, 0, sizeof(stats));
+    ms_begin = k_uptime_get();
+    APP_TRACE(APP_TRACE_DL_BEGIN, chunk_sz, 0);
+    return pipeline_begin(file_id);
+}
+
+int DownloadPipelineWrite(const uint8_t *data, size_t len)
+{
+    if (stats.chunks == 0) {
+        stats.ttfb_ms = k_uptime_get() - ms_begin;
+    }
+    stats.chunks++;
+    stats.bytes += len;
+    APP_TRACE(APP_TRACE_DL_CHUNK, len, stats.bytes);
+    return pipeline_write(data, len);
+}
+
+int DownloadPipelineEnd(int result)
+{
+    int ret = pipeline_end(result);
+
+    stats.elapsed_ms = k_uptime_get() - ms_begin;
+    APP_TRACE(APP_TRACE_DL_END, stats.chunks, ret);
+#if defined(CONFIG_APP_DOWNLOAD_CHUNK_ADAPTIVE)
+    chunk_adapt(result, stats.elapsed_ms);
+#endif
+    return ret;
+}
@@ -0,0 +1,712 @@
+/*
+ * Copyright (c) 2023 SAKURA internet Inc.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/base64.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/crc.h>
+
+#include "app_mem.h"
+#include "download_checkpoint.h"
+#include "download_digest.h"
+#include "download_inflate.h"
+#include "download_manifest.h"
+#include "download_sink.h"
+#include "flash_sink.h"
+#include "fota.h"
+#include "hex_encode.h"
+#include "uart_broker.h"
+
+LOG_MODULE_DECLARE(sipf, CONFIG_SIPF_LOG_LEVEL);
+
+#if defined(CONFIG_APP_DOWNLOAD_OUTPUT_BASE64)
+#define DEFAULT_MODE DOWNLOAD_OUTPUT_BASE64
+#elif defined(CONFIG_APP_DOWNLOAD_OUTPUT_RAW)
+#define DEFAULT_MODE DOWNLOAD_OUTPUT_RAW
+#elif defined(CONFIG_APP_DOWNLOAD_OUTPUT_NONE)
+#define DEFAULT_MODE DOWNLOAD_OUTPUT_NONE
+#else
+#define DEFAULT_MODE DOWNLOAD_OUTPUT_HEX
+#endif
+
+static enum download_output_mode output_mode = DEFAULT_MODE;
+/* mode latched at DownloadSinkBegin() so a change never splits a file */
+static enum download_output_mode cur_mode;
+/* 次のファイルだけの出力モード(-1: output_modeに従う) */
+static int next_mode = -1;
+
+static bool store = IS_ENABLED(CONFIG_APP_FLASH_SINK);
+static bool cur_store;
+
+/* ファームウェアイメージ(MCUbootのセカンダリスロットへ保存) */
+static bool cur_image;
+#if defined(CONFIG_APP_FOTA)
+static bool next_image;
+#endif
+
+#if defined(CONFIG_APP_DOWNLOAD_DIGEST)
+/* 次のファイルの期待値(サーバ側の値)と、最後に計算したダイジェスト */
+static uint8_t next_digest[DOWNLOAD_DIGEST_SZ];
+static bool next_digest_set;
+static uint8_t cur_digest[DOWNLOAD_DIGEST_SZ];
+static bool cur_verify;
+static uint8_t last_digest[DOWNLOAD_DIGEST_SZ];
+static bool last_digest_valid;
+#endif
+
+#if defined(CONFIG_APP_DOWNLOAD_INFLATE)
+/* 圧縮ファイルは展開してから保存・出力する */
+static bool cur_inflate;
+static int sink_write(const uint8_t *data, size_t len);
+#endif
+
+#if defined(CONFIG_APP_FLASH_SINK)
+/* stream position / CRC32 of every byte received for the stored file */
+static uint32_t st_pos;
+static uint32_t st_crc;
+/* 最後に保存を確定したファイル(イメージは除く) */
+static uint32_t stored_size;
+static uint32_t stored_crc;
+static bool stored_valid;
+#if defined(CONFIG_APP_DOWNLOAD_RESUME)
+#define CKPT_INTERVAL (CONFIG_APP_DOWNLOAD_CHECKPOINT_INTERVAL)
+static char st_file_id[DOWNLOAD_FILE_ID_MAX];
+static uint32_t st_skip;     /* 再開時、既にフラッシュにある先頭部分の長さ */
+static uint32_t st_skip_crc; /* その部分のCRC32(チェックポイントの値) */
+static uint32_t st_ckpt;     /* 最後に保存したチェックポイント */
+#endif
+#if defined(CONFIG_APP_DOWNLOAD_DELTA)
+/* フラッシュにあるコピーのブロックハッシュ。受信しながら新しいファイルの値に更新する */
+static struct download_manifest *st_mf; /* from the arena on first use */
+static bool st_mf_saved; /* st_mfがまだ保存されている(フラッシュを書き換えていない) */
+static bool st_delta;    /* st_mf->block_crcを更新中 */
+#endif
+#endif
+
+/* DownloadSinkReplay(): bytes read from flash at a time (multiple of 3 for base64) */
+#define REPLAY_CHUNK (192)
+
+/* base64: input bytes per UartBrokerChPut() (multiple of 3) */
+#define B64_BLOCK (192)
+static uint8_t b64_buff[(B64_BLOCK / 3) * 4 + 1];
+/* 3バイトに満たない端数はチャンクをまたいで持ち越す */
+static uint8_t b64_carry[2];
+static size_t b64_carry_len;
+
+static const char *const mode_name[DOWNLOAD_OUTPUT_MODE_NUM] = {
+    [DOWNLOAD_OUTPUT_HEX] = "hex",
+    [DOWNLOAD_OUTPUT_BASE64] = "base64",
+    [DOWNLOAD_OUTPUT_RAW] = "raw",
+    [DOWNLOAD_OUTPUT_NONE] = "none",
+};
+
+static int raw_frame(uint8_t type, const uint8_t *payload, size_t len)
+{
+    uint8_t hdr[DOWNLOAD_RAW_HDR_SZ] = {DOWNLOAD_RAW_SYNC0, DOWNLOAD_RAW_SYNC1, type};
+
+    sys_put_le16((uint16_t)len, &hdr[3]);
+    if (UartBrokerChPut(UART_BROKER_DATA, hdr, sizeof(hdr)) != sizeof(hdr)) {
+        return -EIO;
+    }
+    if ((len > 0) && (UartBrokerChPut(UART_BROKER_DATA, (uint8_t *)payload, len) != (int)len)) {
+        return -EIO;
+    }
+    return 0;
+}
+
+static int b64_put(const uint8_t *data, size_t len)
+{
+    size_t olen;
+
+    if (base64_encode(b64_buff, sizeof(b64_buff), &olen, data, len) != 0) {
+        return -EINVAL;
+    }
+    if (UartBrokerChPut(UART_BROKER_DATA, b64_buff, olen) != (int)olen) {
+        return -EIO;
+    }
+    return 0;
+}
+
+static int b64_write(const uint8_t *data, size_t len)
+{
+    int err;
+
+    // 持ち越し分を先に3バイトにして出す
+    if (b64_carry_len > 0) {
+        uint8_t tmp[3];
+        size_t fill = MIN(3 - b64_carry_len, len);
+        memcpy(tmp, b64_carry, b64_carry_len);
+        memcpy(&tmp[b64_carry_len], data, fill);
+        data += fill;
+        len -= fill;
+        if (b64_carry_len + fill < 3) {
+            memcpy(b64_carry, tmp, b64_carry_len + fill);
+            b64_carry_len += fill;
+            return 0;
+        }
+        b64_carry_len = 0;
+        err = b64_put(tmp, 3);
+        if (err) {
+            return err;
+        }
+    }
+    while (len >= 3) {
+        size_t n = MIN(ROUND_DOWN(len, 3), B64_BLOCK);
+        err = b64_put(data, n);
+        if (err) {
+            return err;
+        }
+        data += n;
+        len -= n;
+    }
+    memcpy(b64_carry, data, len);
+    b64_carry_len = len;
+    return 0;
+}
+
+int DownloadSinkSetMode(enum download_output_mode mode)
+{
+    if ((unsigned int)mode >= DOWNLOAD_OUTPUT_MODE_NUM) {
+        return -EINVAL;
+    }
+    output_mode = mode;
+    return 0;
+}
+
+int DownloadSinkSetNextMode(int mode)
+{
+    if ((mode < -1) || (mode >= DOWNLOAD_OUTPUT_MODE_NUM)) {
+        return -EINVAL;
+    }
+    next_mode = mode;
+    return 0;
+}
+
+enum download_output_mode DownloadSinkGetMode(void)
+{
+    return output_mode;
+}
+
+const char *DownloadSinkModeName(enum download_output_mode mode)
+{
+    if ((unsigned int)mode >= DOWNLOAD_OUTPUT_MODE_NUM) {
+        return "?";
+    }
+    return mode_name[mode];
+}
+
+int DownloadSinkSetStore(bool enable)
+{
+    if (!IS_ENABLED(CONFIG_APP_FLASH_SINK) && enable) {
+        return -ENOTSUP;
+    }
+    store = enable;
+    return 0;
+}
+
+bool DownloadSinkGetStore(void)
+{
+    return store;
+}
+
+int DownloadSinkSetImage(bool image)
+{
+#if defined(CONFIG_APP_FOTA)
+    next_image = image;
+    return 0;
+#else
+    return image ? -ENOTSUP : 0;
+#endif
+}
+
+int DownloadSinkSetDigest(const uint8_t *expected)
+{
+#if defined(CONFIG_APP_DOWNLOAD_DIGEST)
+    next_digest_set = (expected != NULL);
+    if (next_digest_set) {
+        memcpy(next_digest, expected, sizeof(next_digest));
+    }
+    return 0;
+#else
+    return (expected != NULL) ? -ENOTSUP : 0;
+#endif
+}
+
+int DownloadSinkGetDigest(uint8_t *digest)
+{
+#if defined(CONFIG_APP_DOWNLOAD_DIGEST)
+    if (!last_digest_valid) {
+        return -ENOENT;
+    }
+    memcpy(digest, last_digest, sizeof(last_digest));
+    return 0;
+#else
+    return -ENOENT;
+#endif
+}
+
+#if defined(CONFIG_APP_DOWNLOAD_DIGEST)
+/* Returns -EBADMSG if the file does not match the expected digest */
+static int digest_end(void)
+{
+    char hex[DOWNLOAD_DIGEST_SZ * 2 + 1];
+    int err = DownloadDigestEnd(last_digest);
+
+    if (err) {
+        return err;
+    }
+    last_digest_valid = true;
+    HexEncode(hex, last_digest, sizeof(last_digest));
+    hex[sizeof(hex) - 1] = '\0';
+    LOG_INF("%s %s (%u us)", DownloadDigestName(), hex, DownloadDigestBusyUs());
+    if (cur_verify && (memcmp(last_digest, cur_digest, sizeof(cur_digest)) != 0)) {
+        LOG_ERR("%s mismatch", DownloadDigestName());
+#if defined(CONFIG_APP_DOWNLOAD_RESUME)
+        // 期待値と違うファイルの続きからは再開しない
+        DownloadCheckpointClear();
+#endif
+        return -EBADMSG;
+    }
+    return 0;
+}
+#endif
+
+#if defined(CONFIG_APP_FLASH_SINK)
+#if defined(CONFIG_APP_DOWNLOAD_DELTA)
+/* 最初のブロックを消去する前に呼ばれる: 途中で電源が切れても古いマニフェストを残さない */
+static void store_mf_changed(void)
+{
+    DownloadManifestClear();
+    st_mf_saved = false;
+}
+#endif
+
+static int store_begin(const char *file_id, bool image)
+{
+    uint32_t offset = 0;
+    uint32_t crc = 0;
+    int ret;
+
+#if defined(CONFIG_APP_FOTA)
+    // 再起動待ちのイメージを上書きしない
+    if (!image && (FotaCheckFileStore() != 0)) {
+        LOG_ERR("%s: an update waits for the reset", file_id);
+        return -EBUSY;
+    }
+#endif
+    ret = FlashSinkSelect(image ? FLASH_SINK_AREA_IMAGE : FLASH_SINK_AREA_FILE);
+    if (ret) {
+        return ret;
+    }
+    st_pos = 0;
+    st_crc = 0;
+#if defined(CONFIG_APP_DOWNLOAD_RESUME)
+    struct download_checkpoint ckpt;
+
+    strncpy(st_file_id, file_id, sizeof(st_file_id) - 1);
+    st_file_id[sizeof(st_file_id) - 1] = '\0';
+    if (DownloadCheckpointGet(file_id, &ckpt) == 0) {
+        // 前回の続きから書き込む
+        offset = ckpt.offset;
+        crc = ckpt.crc;
+        LOG_INF("Resume %s from %u", file_id, offset);
+    } else {
+        DownloadCheckpointClear();
+    }
+    st_skip = offset;
+    st_skip_crc = crc;
+    st_ckpt = offset;
+#endif
+#if defined(CONFIG_APP_DOWNLOAD_DELTA)
+    int err;
+    size_t count = 0;
+
+    st_mf_saved = false;
+    st_delta = false;
+    if (st_mf == NULL) {
+        st_mf = AppArenaAlloc(sizeof(*st_mf), "delta manifest");
+        if (st_mf == NULL) {
+            // マニフェストなしで保存する
+            DownloadManifestClear();
+            return FlashSinkBegin(offset, crc);
+        }
+    }
+    // イメージはスワップでスロットの内容が入れ替わるので差分の対象にしない
+    if ((offset == 0) && !image) {
+        if (DownloadManifestLoad(file_id, st_mf) == 0) {
+            // 前回保存したファイルとの差分だけ書き込む
+            count = st_mf->count;
+            st_mf_saved = true;
+            LOG_INF("Delta against the stored %s (%u bytes, %u blocks)", file_id, st_mf->size, (uint32_t)count);
+        }
+    }
+    if (!st_mf_saved) {
+        // 再開時や別のファイルではフラッシュの内容とマニフェストが合わなくなる
+        DownloadManifestClear();
+        memset(st_mf, 0, offsetof(struct download_manifest, block_crc));
+        strncpy(st_mf->file_id, file_id, sizeof(st_mf->file_id) - 1);
+    }
+    err = FlashSinkBegin(offset, crc);
+    if (err || (offset != 0) || image) {
+        return err;
+    }
+    err = FlashSinkSetDelta(st_mf->block_crc, count, DOWNLOAD_MANIFEST_MAX_BLOCKS, st_mf_saved ? store_mf_changed : NULL);
+    if (err) {
+        LOG_WRN("Delta disabled: %d", err);
+        if (st_mf_saved) {
+            // 全ブロックを書き直すので先に消す
+            DownloadManifestClear();
+            st_mf_saved = false;
+        }
+    }
+    st_delta = (err == 0);
+    return 0;
+#else
+    return FlashSinkBegin(offset, crc);
+#endif
+}
+
+static int store_write(const uint8_t *data, size_t len)
+{
+    int err;
+
+#if defined(CONFIG_APP_DOWNLOAD_RESUME)
+    /*
+     * SipfFileDownload() always streams from byte 0, so the part that is
+     * already in flash is not rewritten; it is only checked against the
+     * checkpoint CRC to make sure the file did not change in between.
+     */
+    if (st_pos < st_skip) {
+        size_t n = MIN(len, st_skip - st_pos);
+        // 再開点までの分だけで比べる(チャンクは再開点をまたぐことがある)
+        st_crc = crc32_ieee_update(st_crc, data, n);
+        st_pos += n;
+        data += n;
+        len -= n;
+        if (st_pos < st_skip) {
+            return 0;
+        }
+        if (st_crc != st_skip_crc) {
+            LOG_ERR("%s changed since the checkpoint, checkpoint dropped", st_file_id);
+            DownloadCheckpointClear();
+            return -ESTALE;
+        }
+    }
+#endif
+    st_crc = crc32_ieee_update(st_crc, data, len);
+    st_pos += len;
+    err = FlashSinkWrite(data, len);
+    if (err) {
+        return err;
+    }
+#if defined(CONFIG_APP_DOWNLOAD_RESUME)
+    uint32_t offset, crc;
+    if ((FlashSinkResumePoint(&offset, &crc) == 0) && (offset >= st_ckpt + CKPT_INTERVAL)) {
+        if (DownloadCheckpointSave(st_file_id, offset, crc) == 0) {
+            st_ckpt = offset;
+        }
+    }
+#endif
+    return 0;
+}
+
+/* Returns stored size, or a negative error when the stored copy can't be trusted */
+static int store_end(int result)
+{
+    int stored = FlashSinkEnd();
+    uint32_t crc;
+
+    if (stored < 0) {
+        return stored;
+    }
+    if (result < 0) {
+#if defined(CONFIG_APP_DOWNLOAD_RESUME)
+        LOG_INF("Interrupted, checkpoint at %u", st_ckpt);
+#endif
+        return result;
+    }
+    // 受信したストリームとフラッシュの内容が一致するか確認
+    if ((uint32_t)stored != st_pos) {
+        LOG_ERR("size mismatch: stored %d, received %u", stored, st_pos);
+#if defined(CONFIG_APP_DOWNLOAD_RESUME)
+        // 壊れた先頭部分から再開しないようにする
+        DownloadCheckpointClear();
+#endif
+        return -EIO;
+    }
+    if ((FlashSinkCrc(stored, &crc) != 0) || (crc != st_crc)) {
+        LOG_ERR("CRC mismatch: flash %08x, received %08x", crc, st_crc);
+#if defined(CONFIG_APP_DOWNLOAD_RESUME)
+        DownloadCheckpointClear();
+#endif
+#if defined(CONFIG_APP_DOWNLOAD_DELTA)
+        DownloadManifestClear();
+#endif
+        return -EIO;
+    }
+#if defined(CONFIG_APP_DOWNLOAD_RESUME)
+    DownloadCheckpointClear();
+#endif
+#if defined(CONFIG_APP_DOWNLOAD_DELTA)
+    size_t skipped, programmed;
+    size_t count = DIV_ROUND_UP(stored, CONFIG_APP_FLASH_SINK_BUF_SIZE);
+
+    FlashSinkGetDelta(&skipped, &programmed);
+    LOG_INF("Delta: %u bytes unchanged, %u programmed", (uint32_t)skipped, (uint32_t)programmed);
+    if (st_delta && (count <= DOWNLOAD_MANIFEST_MAX_BLOCKS) && (!st_mf_saved || (st_mf->size != (uint32_t)stored) || (st_mf->crc != crc))) {
+        st_mf->size = stored;
+        st_mf->crc = crc;
+        st_mf->block_size = CONFIG_APP_FLASH_SINK_BUF_SIZE;
+        st_mf->count = count;
+        if (DownloadManifestSave(st_mf) == 0) {
+            st_mf_saved = true;
+        }
+    }
+#endif
+    LOG_INF("Stored %d bytes, CRC32 %08x", stored, crc);
+#if defined(CONFIG_APP_FOTA)
+    if (cur_image) {
+        int err = FotaImageReady(stored);
+        if (err) {
+            return err;
+        }
+        return stored;
+    }
+#endif
+    stored_size = stored;
+    stored_crc = crc;
+    stored_valid = true;
+    return stored;
+}
+#endif
+
+/* 1ファイル限りのモードがあればそれを使う */
+static void download_sink_latch_mode(void)
+{
+    cur_mode = (next_mode >= 0) ? (enum download_output_mode)next_mode : output_mode;
+    next_mode = -1;
+}
+
+int DownloadSinkBegin(const char *file_id)
+{
+    download_sink_latch_mode();
+    cur_store = store;
+    b64_carry_len = 0;
+#if defined(CONFIG_APP_FOTA)
+    // イメージは必ずフラッシュに保存し、UARTには出さない
+    cur_image = next_image;
+    next_image = false;
+    if (cur_image) {
+        cur_store = true;
+        cur_mode = DOWNLOAD_OUTPUT_NONE;
+    }
+#endif
+#if defined(CONFIG_APP_DOWNLOAD_DIGEST)
+    // 期待値は1ファイル限り
+    cur_verify = next_digest_set;
+    memcpy(cur_digest, next_digest, sizeof(cur_digest));
+    next_digest_set = false;
+    last_digest_valid = false;
+    DownloadDigestBegin();
+#endif
+#if defined(CONFIG_APP_DOWNLOAD_INFLATE)
+    cur_inflate = DownloadInflateMatch(file_id);
+    if (cur_inflate) {
+        int err = DownloadInflateBegin(sink_write);
+        if (err) {
+            cur_inflate = false;
+            return err;
+        }
+    }
+#endif
+#if defined(CONFIG_APP_FLASH_SINK)
+    stored_valid = false;
+    if (cur_store) {
+        int err = store_begin(file_id, cur_image);
+        if (err) {
+            return err;
+        }
+    }
+#endif
+    if (cur_mode == DOWNLOAD_OUTPUT_RAW) {
+        return raw_frame(DOWNLOAD_RAW_BEGIN, (const uint8_t *)file_id, strlen(file_id));
+    }
+    return 0;
+}
+
+static int uart_write(const uint8_t *data, size_t len)
+{
+    switch (cur_mode) {
+    case DOWNLOAD_OUTPUT_RAW:
+        // 1フレームの最大長で分割
+        while (len > 0) {
+            size_t n = MIN(len, UINT16_MAX);
+            int err = raw_frame(DOWNLOAD_RAW_DATA, data, n);
+            if (err) {
+                return err;
+            }
+            data += n;
+            len -= n;
+        }
+        return 0;
+    case DOWNLOAD_OUTPUT_BASE64:
+        return b64_write(data, len);
+    case DOWNLOAD_OUTPUT_NONE:
+        return 0;
+    case DOWNLOAD_OUTPUT_HEX:
+    default:
+        return (HexDumpPut(data, len) == (int)(len * 2)) ? 0 : -EIO;
+    }
+}
+
+static int sink_write(const uint8_t *data, size_t len)
+{
+#if defined(CONFIG_APP_FLASH_SINK)
+    if (cur_store) {
+        int err = store_write(data, len);
+        if (err) {
+            return err;
+        }
+    }
+#endif
+    return uart_write(data, len);
+}
+
+int DownloadSinkWrite(const uint8_t *data, size_t len)
+{
+#if defined(CONFIG_APP_DOWNLOAD_DIGEST)
+    // サーバにあるファイルそのもの(展開前)のダイジェスト
+    DownloadDigestUpdate(data, len);
+#endif
+#if defined(CONFIG_APP_DOWNLOAD_INFLATE)
+    if (cur_inflate) {
+        return DownloadInflateWrite(data, len);
+    }
+#endif
+    return sink_write(data, len);
+}
+
+/* Trailer of the UART output: END frame, base64 remainder or CRLF */
+static int uart_end(int result)
+{
+    uint8_t res[4];
+
+    switch (cur_mode) {
+    case DOWNLOAD_OUTPUT_RAW:
+        sys_put_le32((uint32_t)result, res);
+        return raw_frame(DOWNLOAD_RAW_END, res, sizeof(res));
+    case DOWNLOAD_OUTPUT_BASE64:
+        if (b64_carry_len > 0) {
+            b64_put(b64_carry, b64_carry_len);
+            b64_carry_len = 0;
+        }
+        UartBrokerChPuts(UART_BROKER_DATA, "\r\n");
+        return 0;
+    case DOWNLOAD_OUTPUT_NONE:
+        return 0;
+    case DOWNLOAD_OUTPUT_HEX:
+    default:
+        UartBrokerChPuts(UART_BROKER_DATA, "\r\n");
+        return 0;
+    }
+}
+
+int DownloadSinkEnd(int result)
+{
+    int err = 0;
+
+#if defined(CONFIG_APP_DOWNLOAD_INFLATE)
+    if (cur_inflate) {
+        uint32_t expanded = DownloadInflateEnd();
+        cur_inflate = false;
+        if (result >= 0) {
+            LOG_INF("Inflated %d -> %u bytes", result, expanded);
+            result = expanded;
+        }
+    }
+#endif
+#if defined(CONFIG_APP_DOWNLOAD_DIGEST)
+    if (result >= 0) {
+        // 保存したファイルを確定する前に照合する
+        int ret = digest_end();
+        if (ret < 0) {
+            err = ret;
+            result = ret;
+        }
+    }
+#endif
+
+#if defined(CONFIG_APP_FLASH_SINK)
+    if (cur_store) {
+        int stored = store_end(result);
+        if ((stored < 0) && (result >= 0)) {
+            err = stored;
+            result = stored;
+        }
+        cur_store = false;
+    }
+#endif
+
+    if ((uart_end(result) != 0) && (err == 0)) {
+        err = -EIO;
+    }
+    return err;
+}
+
+int DownloadSinkGetStored(uint32_t *size, uint32_t *crc)
+{
+#if defined(CONFIG_APP_FLASH_SINK)
+    if (!stored_valid) {
+        return -ENOENT;
+    }
+    *size = stored_size;
+    *crc = stored_crc;
+    return 0;
+#else
+    return -ENOENT;
+#endif
+}
+
+int DownloadSinkReplay(const char *file_id, uint32_t size)
+{
+#if defined(CONFIG_APP_FLASH_SINK)
+    uint8_t buff[REPLAY_CHUNK];
+    uint32_t off = 0;
+    int err;
+
+    download_sink_latch_mode();
+    cur_store = false;
+    b64_carry_len = 0;
+    err = FlashSinkSelect(FLASH_SINK_AREA_FILE);
+    if (err) {
+        return err;
+    }
+    if (cur_mode == DOWNLOAD_OUTPUT_RAW) {
+        err = raw_frame(DOWNLOAD_RAW_BEGIN, (const uint8_t *)file_id, strlen(file_id));
+    }
+    // 保存済みのコピーをダウンロードしたときと同じ形式で出す
+    while ((err == 0) && (off < size) && (cur_mode != DOWNLOAD_OUTPUT_NONE)) {
+        size_t n = MIN(sizeof(buff), size - off);
+        err = FlashSinkRead(off, buff, n);
+        if (err == 0) {
+            err = uart_write(buff, n);
+        }
+        off += n;
+    }
+    if (err) {
+        uart_end(err);
+        return err;
+    }
+    return (uart_end(size) == 0) ? (int)size : -EIO;
+#else
+    return -ENOTSUP;
+#endif
+}
@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2023 SAKURA internet Inc.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/byteorder.h>
+
+#include <nrf_modem_at.h>
+#include <modem/lte_lc.h>
+#include <modem/modem_info.h>
+
+#include "sipf/sipf_file.h"
+#include "download_pipeline.h"
+#include "download_stats.h"
+#include "lte_conn.h"
+#include "uart_broker.h"
+
+LOG_MODULE_DECLARE(sipf, CONFIG_SIPF_LOG_LEVEL);
+
+static struct download_stats stats;
+static uint64_t rrc_begin;
+static K_MUTEX_DEFINE(lock_stats);
+
+/* 無線の状態(ダウンロード終了時点) */
+static void download_stats_radio(struct download_stats *st)
+{
+    char cell[16];
+    int rsrp;
+    int rsrq;
+    uint8_t band;
+    enum lte_lc_lte_mode mode;
+
+    st->rsrp = INT16_MIN;
+    st->rsrq_x10 = INT16_MIN;
+    if (modem_info_get_rsrp(&rsrp) == 0) {
+        st->rsrp = rsrp;
+    }
+    if (modem_info_get_current_band(&band) == 0) {
+        st->band = band;
+    }
+    if (modem_info_string_get(MODEM_INFO_CELLID, cell, sizeof(cell)) > 0) {
+        st->cell_id = strtoul(cell, NULL, 16);
+    }
+    if (lte_lc_lte_mode_get(&mode) == 0) {
+        st->lte_mode = mode;
+    }
+    // modem_infoにRSRQが無いので+CESQから取る(0-34: -19.5dB + 0.5dB刻み, 255: 不明)
+    if ((nrf_modem_at_scanf("AT+CESQ", "+CESQ: %*d,%*d,%*d,%*d,%d,%*d", &rsrq) == 1) && (rsrq != 255)) {
+        st->rsrq_x10 = rsrq * 5 - 195;
+    }
+}
+
+/** Interface **/
+
+int DownloadStatsInit(void)
+{
+    int err = modem_info_init();
+    if (err) {
+        LOG_ERR("modem_info_init() failed: %d", err);
+    }
+    return err;
+}
+
+void DownloadStatsBegin(const char *file_id)
+{
+    k_mutex_lock(&lock_stats, K_FOREVER);
+    memset(&stats, 0, sizeof(stats));
+    strncpy(stats.file_id, file_id, sizeof(stats.file_id) - 1);
+    k_mutex_unlock(&lock_stats);
+    rrc_begin = LteConnRrcConnectedMs();
+}
+
+int DownloadStatsCallback(int (*cb)(uint8_t *buff, size_t len), uint8_t *buff, size_t len)
+{
+    uint32_t t = k_cycle_get_32();
+    int ret = cb(buff, len);
+    uint32_t us = k_cyc_to_us_floor32(k_cycle_get_32() - t);
+
+    stats.cb_total_us += us;
+    stats.cb_max_us = MAX(stats.cb_max_us, us);
+    return ret;
+}
+
+void DownloadStatsEnd(int result)
+{
+    struct download_pipeline_stats ps;
+
+    DownloadPipelineGetStats(&ps);
+    k_mutex_lock(&lock_stats, K_FOREVER);
+    stats.result = result;
+    stats.bytes = ps.bytes;
+    stats.elapsed_ms = ps.elapsed_ms;
+    stats.ttfb_ms = ps.ttfb_ms;
+    stats.chunks = ps.chunks;
+    stats.stalls = ps.stalls;
+    stats.stall_ms = ps.stall_ms;
+    stats.bps = (ps.elapsed_ms > 0) ? (uint32_t)((uint64_t)ps.bytes * MSEC_PER_SEC / ps.elapsed_ms) : 0;
+    stats.rrc_ms = LteConnRrcConnectedMs() - rrc_begin;
+    download_stats_radio(&stats);
+    k_mutex_unlock(&lock_stats);
+}
+
+void DownloadStatsGet(struct download_stats *st)
+{
+    k_mutex_lock(&lock_stats, K_FOREVER);
+    *st = stats;
+    k_mutex_unlock(&lock_stats);
+}
+
+void DownloadStatsPrint(void)
+{
+    struct download_stats st;
+
+    DownloadStatsGet(&st);
+    UartBrokerPrintf("file: %s, result: %d\r\n", st.file_id, st.result);
+    UartBrokerPrintf("bytes: %u, elapsed: %u ms, %u B/s\r\n", st.bytes, st.elapsed_ms, st.bps);
+    UartBrokerPrintf("ttfb: %u ms, rrc: %u ms\r\n", st.ttfb_ms, st.rrc_ms);
+    UartBrokerPrintf("chunks: %u, cb max: %u us, cb avg: %u us\r\n", st.chunks, st.cb_max_us, (st.chunks > 0) ? st.cb_total_us / st.chunks : 0);
+    UartBrokerPrintf("stalls: %u, %u ms\r\n", st.stalls, st.stall_ms);
+    UartBrokerPrintf("cell: %08x, band: %u, mode: %u, rsrp: %d dBm, rsrq: %s%d.%d dB\r\n", st.cell_id, st.band, st.lte_mode, st.rsrp, (st.rsrq_x10 < 0) ? "-" : "",
+                    abs(st.rsrq_x10 / 10), abs(st.rsrq_x10 % 10));
+}
+
+int DownloadStatsEncode(uint8_t *buf, size_t size)
+{
+    struct download_stats st;
+    uint8_t *p = buf;
+
+    if (size < DOWNLOAD_STATS_RECORD_SZ) {
+        return -ENOMEM;
+    }
+    DownloadStatsGet(&st);
+    const uint32_t fields[] = {
+        st.result, st.bytes, st.elapsed_ms, st.ttfb_ms, st.chunks, st.cb_max_us, st.cb_total_us, st.stalls, st.stall_ms, st.bps, st.rrc_ms, st.cell_id,
+    };
+    *p++ = DOWNLOAD_STATS_VERSION;
+    *p++ = st.lte_mode;
+    *p++ = st.band;
+    *p++ = 0;
+    BUILD_ASSERT(DOWNLOAD_STATS_RECORD_SZ == 4 + sizeof(fields) + 2 * 2 + 4, "record layout");
+    for (size_t i = 0; i < ARRAY_SIZE(fields); i++) {
+        sys_put_le32(fields[i], p);
+        p += 4;
+    }
+    sys_put_le16(st.rsrp, p);
+    p += 2;
+    sys_put_le16(st.rsrq_x10, p);
+    p += 2;
+    sys_put_le32(k_uptime_get() / MSEC_PER_SEC, p);
+    p += 4;
+    return p - buf;
+}
+
+int DownloadStatsUpload(void)
+{
+    uint8_t rec[DOWNLOAD_STATS_RECORD_SZ];
+    int len = DownloadStatsEncode(rec, sizeof(rec));
+
+    if (len < 0) {
+        return len;
+    }
+    return SipfFileUpload(CONFIG_APP_DOWNLOAD_STATS_FILE_ID, rec, len);
+}
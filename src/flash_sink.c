@@ -0,0 +1,335 @@
+/*
+ * Copyright (c) 2023 SAKURA internet Inc.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/drivers/flash.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/storage/flash_map.h>
+#include <zephyr/sys/crc.h>
+
+#include "app_mem.h"
+#include "flash_sink.h"
+
+LOG_MODULE_DECLARE(sipf, CONFIG_SIPF_LOG_LEVEL);
+
+#define BUF_SZ (CONFIG_APP_FLASH_SINK_BUF_SIZE)
+BUILD_ASSERT((BUF_SZ % 4) == 0, "APP_FLASH_SINK_BUF_SIZE must be word aligned");
+
+/* 書き込み単位に揃えるためのバッファ */
+static uint8_t *buf; /* BUF_SZ, from the arena */
+static size_t buf_len;
+static bool active;
+
+static const struct flash_area *fa_area[FLASH_SINK_AREA_NUM];
+static enum flash_sink_area cur_area;
+static const struct flash_area *fa; /* fa_area[cur_area] */
+static off_t wr_off;     /* 次に書き込むオフセット */
+static off_t erased_end; /* ここまで消去済み(差分でスキップしたブロックを含む) */
+static uint32_t wr_crc;  /* [0, wr_off) のCRC32 */
+static int fs_err;
+
+#if defined(CONFIG_APP_DOWNLOAD_DELTA)
+/* ブロック毎のCRC32。比較後に新しい値で上書きする */
+static uint32_t *dl_crc;
+static size_t dl_base; /* フラッシュにあるコピーのブロック数 */
+static size_t dl_max;
+static size_t dl_skipped;
+static size_t dl_programmed;
+static flash_sink_delta_cb_t dl_changed; /* 最初に書き換えるブロックの消去前に1回 */
+#endif
+
+static int flash_sink_program(const uint8_t *data, size_t len)
+{
+    int err;
+    size_t wlen = ROUND_UP(len, flash_area_align(fa));
+
+    if (wr_off + wlen > fa->fa_size) {
+        return -ENOSPC;
+    }
+    // 書き込み先のページを先に消去
+    while (erased_end < wr_off + (off_t)wlen) {
+        struct flash_pages_info info;
+        err = flash_get_page_info_by_offs(flash_area_get_device(fa), fa->fa_off + erased_end, &info);
+        if (err) {
+            return err;
+        }
+        err = flash_area_erase(fa, erased_end, info.size);
+        if (err) {
+            return err;
+        }
+        erased_end += info.size;
+    }
+    err = flash_area_write(fa, wr_off, data, wlen);
+    if (err) {
+        return err;
+    }
+    wr_crc = crc32_ieee_update(wr_crc, data, len);
+    wr_off += len;
+    return 0;
+}
+
+#if defined(CONFIG_APP_DOWNLOAD_DELTA)
+/* Store whole BUF_SZ blocks (or the last partial one), skipping those already in flash */
+static int flash_sink_store(const uint8_t *data, size_t len)
+{
+    while (len > 0) {
+        size_t n = MIN(len, BUF_SZ);
+        size_t blk = wr_off / BUF_SZ;
+        uint32_t crc = crc32_ieee(data, n);
+        int err;
+
+        if ((dl_crc != NULL) && (blk < dl_max)) {
+            if ((blk < dl_base) && (dl_crc[blk] == crc)) {
+                // 同じ内容のブロックは消去も書き込みもしない
+                wr_crc = crc32_ieee_update(wr_crc, data, n);
+                wr_off += n;
+                erased_end = MAX(erased_end, ROUND_UP(wr_off, BUF_SZ));
+                dl_skipped += n;
+                data += n;
+                len -= n;
+                continue;
+            }
+            dl_crc[blk] = crc;
+        }
+        if (dl_changed != NULL) {
+            flash_sink_delta_cb_t cb = dl_changed;
+            dl_changed = NULL;
+            cb();
+        }
+        err = flash_sink_program(data, n);
+        if (err) {
+            return err;
+        }
+        dl_programmed += n;
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+#else
+#define flash_sink_store flash_sink_program
+#endif
+
+int FlashSinkInit(void)
+{
+    buf = AppArenaAlloc(BUF_SZ, "flash sink");
+    if (buf == NULL) {
+        return -ENOMEM;
+    }
+    int err = flash_area_open(FIXED_PARTITION_ID(FLASH_SINK_PARTITION), &fa_area[FLASH_SINK_AREA_FILE]);
+    if (err) {
+        LOG_ERR("flash_area_open() failed: %d", err);
+        return err;
+    }
+    cur_area = FLASH_SINK_AREA_FILE;
+    fa = fa_area[cur_area];
+    return 0;
+}
+
+int FlashSinkSelect(enum flash_sink_area area)
+{
+    if ((unsigned int)area >= FLASH_SINK_AREA_NUM) {
+        return -EINVAL;
+    }
+    if (active) {
+        return -EBUSY;
+    }
+#if defined(CONFIG_APP_FOTA)
+    if ((area == FLASH_SINK_AREA_IMAGE) && (fa_area[area] == NULL)) {
+        int err = flash_area_open(FIXED_PARTITION_ID(FLASH_SINK_IMAGE_PARTITION), &fa_area[area]);
+        if (err) {
+            LOG_ERR("flash_area_open(image) failed: %d", err);
+            return err;
+        }
+    }
+#endif
+    if (fa_area[area] == NULL) {
+        return -ENODEV;
+    }
+    cur_area = area;
+    fa = fa_area[area];
+    return 0;
+}
+
+enum flash_sink_area FlashSinkGetArea(void)
+{
+    return cur_area;
+}
+
+int FlashSinkBegin(uint32_t offset, uint32_t crc)
+{
+    if ((fa == NULL) || (buf == NULL)) {
+        return -ENODEV;
+    }
+    if (offset > fa->fa_size) {
+        return -EINVAL;
+    }
+    // 再開時は再開点のページから消去し直す
+    wr_off = offset;
+    erased_end = offset;
+    wr_crc = crc;
+    fs_err = 0;
+    buf_len = 0;
+    active = true;
+#if defined(CONFIG_APP_DOWNLOAD_DELTA)
+    dl_crc = NULL;
+    dl_base = 0;
+    dl_max = 0;
+    dl_skipped = 0;
+    dl_programmed = 0;
+    dl_changed = NULL;
+#endif
+    return 0;
+}
+
+#if defined(CONFIG_APP_DOWNLOAD_DELTA)
+int FlashSinkSetDelta(uint32_t *crc, size_t count, size_t max, flash_sink_delta_cb_t changed)
+{
+    struct flash_pages_info info;
+    int err;
+
+    if (!active || (wr_off != 0)) {
+        return -EINVAL;
+    }
+    // ブロックは消去ページ単位でなければならない
+    err = flash_get_page_info_by_offs(flash_area_get_device(fa), fa->fa_off, &info);
+    if (err) {
+        return err;
+    }
+    if ((BUF_SZ % info.size) != 0) {
+        LOG_ERR("FlashSink: block size %d is not a multiple of the page size %d", BUF_SZ, (int)info.size);
+        return -EINVAL;
+    }
+    dl_crc = crc;
+    dl_base = MIN(count, max);
+    dl_max = max;
+    dl_changed = changed;
+    return 0;
+}
+
+void FlashSinkGetDelta(size_t *skipped, size_t *programmed)
+{
+    *skipped = dl_skipped;
+    *programmed = dl_programmed;
+}
+#endif
+
+int FlashSinkWrite(const uint8_t *data, size_t len)
+{
+    if (!active) {
+        return -EINVAL;
+    }
+    if (fs_err) {
+        return fs_err;
+    }
+    // バッファが空で丸ごと書ける分はコピーせずに直接書く
+    if (buf_len == 0) {
+        size_t n = ROUND_DOWN(len, BUF_SZ);
+        if (n > 0) {
+            fs_err = flash_sink_store(data, n);
+            if (fs_err) {
+                return fs_err;
+            }
+            data += n;
+            len -= n;
+        }
+    }
+    while (len > 0) {
+        size_t n = MIN(len, BUF_SZ - buf_len);
+        memcpy(&buf[buf_len], data, n);
+        buf_len += n;
+        data += n;
+        len -= n;
+        if (buf_len == BUF_SZ) {
+            fs_err = flash_sink_store(buf, buf_len);
+            buf_len = 0;
+            if (fs_err) {
+                return fs_err;
+            }
+        }
+    }
+    return 0;
+}
+
+int FlashSinkEnd(void)
+{
+    if (!active) {
+        return -EINVAL;
+    }
+    active = false;
+    if ((fs_err == 0) && (buf_len > 0)) {
+        // 端数は書き込み単位まで消去値で埋める
+        size_t pad = ROUND_UP(buf_len, flash_area_align(fa)) - buf_len;
+        memset(&buf[buf_len], flash_area_erased_val(fa), pad);
+        fs_err = flash_sink_store(buf, buf_len);
+        buf_len = 0;
+    }
+    if (fs_err) {
+        LOG_ERR("FlashSink: write failed: %d", fs_err);
+        return fs_err;
+    }
+    LOG_DBG("FlashSink: %d bytes stored", (int)wr_off);
+    return wr_off;
+}
+
+int FlashSinkResumePoint(uint32_t *offset, uint32_t *crc)
+{
+    struct flash_pages_info info;
+    int err;
+
+    if (!active || (wr_off == 0)) {
+        return -EAGAIN;
+    }
+    err = flash_get_page_info_by_offs(flash_area_get_device(fa), fa->fa_off + wr_off, &info);
+    if (err) {
+        return err;
+    }
+    if (info.start_offset != fa->fa_off + wr_off) {
+        return -EAGAIN;
+    }
+    *offset = wr_off;
+    *crc = wr_crc;
+    return 0;
+}
+
+int FlashSinkCrc(size_t len, uint32_t *crc)
+{
+    uint8_t tmp[64];
+    uint32_t c = 0;
+    off_t off = 0;
+
+    if (fa == NULL) {
+        return -ENODEV;
+    }
+    while (len > 0) {
+        size_t n = MIN(len, sizeof(tmp));
+        int err = flash_area_read(fa, off, tmp, n);
+        if (err) {
+            return err;
+        }
+        c = crc32_ieee_update(c, tmp, n);
+        off += n;
+        len -= n;
+    }
+    *crc = c;
+    return 0;
+}
+
+int FlashSinkRead(off_t off, void *dst, size_t len)
+{
+    if (fa == NULL) {
+        return -ENODEV;
+    }
+    return flash_area_read(fa, off, dst, len);
+}
+
+size_t FlashSinkCapacity(void)
+{
+    return (fa != NULL) ? fa->fa_size : 0;
+}
@@ -0,0 +1,161 @@
+/*
+ * Copyright (c) 2023 SAKURA internet Inc.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdint.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/dfu/mcuboot.h>
+#include <zephyr/drivers/flash.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/storage/flash_map.h>
+#include <zephyr/sys/reboot.h>
+
+#include "flash_sink.h"
+#include "fota.h"
+#include "lte_conn.h"
+#include "uart_broker.h"
+
+LOG_MODULE_DECLARE(sipf, CONFIG_SIPF_LOG_LEVEL);
+
+#define IMAGE_AREA_ID FIXED_PARTITION_ID(FLASH_SINK_IMAGE_PARTITION)
+#define REBOOT_DELAY_MS (CONFIG_APP_FOTA_REBOOT_DELAY_MS)
+
+static bool fota_pending;
+/* ファイルの保存先がセカンダリスロットと重なっている(TF-M) */
+static bool file_overlaps;
+
+static void fota_reboot(struct k_work *work)
+{
+    UartBrokerPuts("Reboot to apply the update\r\n");
+    k_sleep(K_MSEC(100));
+    sys_reboot(SYS_REBOOT_WARM);
+}
+
+static K_WORK_DELAYABLE_DEFINE(work_reboot, fota_reboot);
+
+/* boot_request_upgrade() writes the trailer at the end of the slot; erase it if the image did not */
+static int fota_erase_trailer(uint32_t size)
+{
+    const struct flash_area *fa;
+    struct flash_pages_info info;
+    int err;
+
+    err = flash_area_open(IMAGE_AREA_ID, &fa);
+    if (err) {
+        return err;
+    }
+    err = flash_get_page_info_by_offs(flash_area_get_device(fa), fa->fa_off + fa->fa_size - 1, &info);
+    if (err == 0) {
+        off_t page = info.start_offset - fa->fa_off;
+        if (size > (uint32_t)page) {
+            // イメージがトレーラのページまで食い込んでいる
+            err = -EFBIG;
+        } else {
+            err = flash_area_erase(fa, page, info.size);
+        }
+    }
+    flash_area_close(fa);
+    return err;
+}
+
+/* 保存先が分からなければ重なっているとみなす */
+static bool fota_file_overlaps(void)
+{
+    const struct flash_area *img;
+    const struct flash_area *file;
+    bool overlaps = true;
+
+    if (flash_area_open(IMAGE_AREA_ID, &img) != 0) {
+        return true;
+    }
+    if (flash_area_open(FIXED_PARTITION_ID(FLASH_SINK_PARTITION), &file) == 0) {
+        overlaps = (file->fa_off < img->fa_off + (off_t)img->fa_size) && (img->fa_off < file->fa_off + (off_t)file->fa_size);
+        flash_area_close(file);
+    }
+    flash_area_close(img);
+    return overlaps;
+}
+
+int FotaInit(void)
+{
+    struct mcuboot_img_header hdr;
+
+    file_overlaps = fota_file_overlaps();
+    if (file_overlaps) {
+        LOG_INF("FOTA: files are stored in the secondary slot");
+    }
+
+    if (boot_read_bank_header(FIXED_PARTITION_ID(slot0_partition), &hdr, sizeof(hdr)) == 0) {
+        UartBrokerPrintf("* Image %u.%u.%u+%u%s\r\n", hdr.h.v1.sem_ver.major, hdr.h.v1.sem_ver.minor, hdr.h.v1.sem_ver.revision, hdr.h.v1.sem_ver.build_num,
+                         boot_is_img_confirmed() ? "" : " (test boot)");
+    }
+    return 0;
+}
+
+int FotaImageReady(uint32_t size)
+{
+    struct mcuboot_img_header hdr;
+    int err;
+
+    // MCUbootのヘッダがあり、イメージが全部書き込まれているか
+    err = boot_read_bank_header(IMAGE_AREA_ID, &hdr, sizeof(hdr));
+    if (err) {
+        LOG_ERR("FOTA: no valid image header: %d", err);
+        return -ENOEXEC;
+    }
+    if (hdr.h.v1.image_size > size) {
+        LOG_ERR("FOTA: image is %u bytes, only %u stored", hdr.h.v1.image_size, size);
+        return -ENOEXEC;
+    }
+    err = fota_erase_trailer(size);
+    if (err) {
+        LOG_ERR("FOTA: trailer erase failed: %d", err);
+        return err;
+    }
+    // 次の起動でテストブート(確認されなければMCUbootが元に戻す)
+    err = boot_request_upgrade(BOOT_UPGRADE_TEST);
+    if (err) {
+        LOG_ERR("boot_request_upgrade() failed: %d", err);
+        return err;
+    }
+    fota_pending = true;
+    UartBrokerPrintf("FOTA: image %u.%u.%u+%u ready\r\n", hdr.h.v1.sem_ver.major, hdr.h.v1.sem_ver.minor, hdr.h.v1.sem_ver.revision, hdr.h.v1.sem_ver.build_num);
+    if (REBOOT_DELAY_MS > 0) {
+        k_work_schedule(&work_reboot, K_MSEC(REBOOT_DELAY_MS));
+    }
+    return 0;
+}
+
+int FotaConfirm(void)
+{
+    int err;
+
+    if (boot_is_img_confirmed()) {
+        return 0;
+    }
+    // テスト起動中は新しいイメージでLTEにつながることを確かめてから確定する
+    err = LteConnWait(-1);
+    if (err) {
+        return err;
+    }
+    err = boot_write_img_confirmed();
+    if (err) {
+        LOG_ERR("boot_write_img_confirmed() failed: %d", err);
+        return err;
+    }
+    UartBrokerPuts("FOTA: image confirmed\r\n");
+    return 0;
+}
+
+bool FotaPending(void)
+{
+    return fota_pending;
+}
+
+int FotaCheckFileStore(void)
+{
+    return (fota_pending && file_overlaps) ? -EBUSY : 0;
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2023 SAKURA internet Inc.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+
+#include "hex_encode.h"
+#include "uart_broker.h"
+
+BUILD_ASSERT(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "hex_lut is laid out for little endian");
+
+/* 1 byte -> 2 chars. The upper digit sits in the low byte so a 16-bit store writes "hl" */
+#define HEX_C(n) ((n) < 10 ? '0' + (n) : 'a' - 10 + (n))
+#define HEX_P(b) (uint16_t)(HEX_C((b) >> 4) | (HEX_C((b)&0xf) << 8))
+#define HEX_P4(b) HEX_P(b), HEX_P((b) + 1), HEX_P((b) + 2), HEX_P((b) + 3)
+#define HEX_P16(b) HEX_P4(b), HEX_P4((b) + 4), HEX_P4((b) + 8), HEX_P4((b) + 12)
+#define HEX_P64(b) HEX_P16(b), HEX_P16((b) + 16), HEX_P16((b) + 32), HEX_P16((b) + 48)
+
+static const uint16_t hex_lut[256] = {HEX_P64(0), HEX_P64(64), HEX_P64(128), HEX_P64(192)};
+
+/* HexDumpPut() staging: input bytes converted per UartBrokerChPut() */
+#define HEX_DUMP_BLOCK (256)
+static char hex_dump_buff[HEX_DUMP_BLOCK * 2];
+static K_MUTEX_DEFINE(mutex_hex_dump);
+
+void HexEncode(char *dst, const uint8_t *src, size_t len)
+{
+    // 4バイトずつ(1ワード読み, 2ワード書き)
+    while (len >= 4) {
+        uint32_t w, lo, hi;
+        memcpy(&w, src, sizeof(w));
+        lo = hex_lut[w & 0xff] | ((uint32_t)hex_lut[(w >> 8) & 0xff] << 16);
+        hi = hex_lut[(w >> 16) & 0xff] | ((uint32_t)hex_lut[w >> 24] << 16);
+        memcpy(dst, &lo, sizeof(lo));
+        memcpy(dst + 4, &hi, sizeof(hi));
+        src += 4;
+        dst += 8;
+        len -= 4;
+    }
+    while (len > 0) {
+        memcpy(dst, &hex_lut[*src], 2);
+        src++;
+        dst += 2;
+        len--;
+    }
+}
+
+static int hex_digit(char c)
+{
+    if ((c >= '0') && (c <= '9')) {
+        return c - '0';
+    }
+    c |= 0x20;
+    if ((c >= 'a') && (c <= 'f')) {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+int HexDecode(uint8_t *dst, const char *src, size_t len)
+{
+    while (len > 0) {
+        int hi = hex_digit(src[0]);
+        int lo = (hi < 0) ? -1 : hex_digit(src[1]);
+        if (lo < 0) {
+            return -EINVAL;
+        }
+        *dst++ = (uint8_t)((hi << 4) | lo);
+        src += 2;
+        len--;
+    }
+    return 0;
+}
+
+int HexDumpPut(const uint8_t *data, size_t len)
+{
+    int cnt = 0;
+
+    k_mutex_lock(&mutex_hex_dump, K_FOREVER);
+    while (len > 0) {
+        size_t n = MIN(len, HEX_DUMP_BLOCK);
+        int ret;
+        HexEncode(hex_dump_buff, data, n);
+        ret = UartBrokerChPut(UART_BROKER_DATA, (uint8_t *)hex_dump_buff, n * 2);
+        cnt += ret;
+        if (ret != (int)(n * 2)) {
+            break;
+        }
+        data += n;
+        len -= n;
+    }
+    k_mutex_unlock(&mutex_hex_dump);
+
+    return cnt;
+}
@@ -0,0 +1,238 @@
+/*
+ * Copyright (c) 2023 SAKURA internet Inc.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+
+#include "download_digest.h"
+#include "download_manager.h"
+#include "download_sink.h"
+#include "download_stats.h"
+#include "hex_encode.h"
+#include "host_cmd.h"
+#include "uart_broker.h"
+
+LOG_MODULE_DECLARE(sipf, CONFIG_SIPF_LOG_LEVEL);
+
+#define PRIORITY (7)
+#define STACK_HC_SZ (2048)
+#define LINE_SZ (DOWNLOAD_FILE_ID_MAX + 96)
+#define FRAME_SZ (160)
+#define ARGS_MAX (4)
+
+K_THREAD_STACK_DEFINE(stack_hc, STACK_HC_SZ);
+static struct k_thread thread_hc;
+static k_tid_t tid_hc;
+
+static host_cmd_line_cb_t line_handler;
+static K_MUTEX_DEFINE(lock_reply);
+static char frame[FRAME_SZ];
+
+static uint8_t host_cmd_checksum(const char *s, size_t len)
+{
+    uint8_t cs = 0;
+
+    for (size_t i = 0; i < len; i++) {
+        cs ^= (uint8_t)s[i];
+    }
+    return cs;
+}
+
+/* "*XX" があれば検証して取り除く */
+static int host_cmd_verify(char *body)
+{
+    char *star = strrchr(body, '*');
+
+    if (star == NULL) {
+        return 0;
+    }
+    if (strlen(&star[1]) != 2) {
+        return -EBADMSG;
+    }
+    if (strtoul(&star[1], NULL, 16) != host_cmd_checksum(body, star - body)) {
+        return -EBADMSG;
+    }
+    *star = '\0';
+    return 0;
+}
+
+static int host_cmd_split(char *body, char **argv)
+{
+    int argc = 0;
+    char *save;
+    char *tok = strtok_r(body, " ,", &save);
+
+    while ((tok != NULL) && (argc < ARGS_MAX)) {
+        argv[argc++] = tok;
+        tok = strtok_r(NULL, " ,", &save);
+    }
+    return argc;
+}
+
+static int host_cmd_mode(const char *name)
+{
+    for (int i = 0; i < DOWNLOAD_OUTPUT_MODE_NUM; i++) {
+        if (strcmp(name, DownloadSinkModeName(i)) == 0) {
+            return i;
+        }
+    }
+    return -EINVAL;
+}
+
+static void host_cmd_done(const char *file_id, int result)
+{
+    HostCmdReply("FDONE,%s,%d", file_id, result);
+}
+
+static void host_cmd_fget(int argc, char **argv)
+{
+    int mode = DOWNLOAD_MANAGER_MODE_KEEP;
+    uint8_t digest[DOWNLOAD_DIGEST_SZ];
+    bool has_digest = false;
+    int ret;
+
+    if (argc < 2) {
+        HostCmdReply("FGET,ERR,%d", -EINVAL);
+        return;
+    }
+    // モード名とダイジェスト(hex)はどちらも省略可
+    for (int i = 2; i < argc; i++) {
+        ret = host_cmd_mode(argv[i]);
+        if (ret >= 0) {
+            mode = ret;
+        } else if ((strlen(argv[i]) == sizeof(digest) * 2) && (HexDecode(digest, argv[i], sizeof(digest)) == 0)) {
+            has_digest = true;
+        } else {
+            HostCmdReply("FGET,ERR,%d", -EINVAL);
+            return;
+        }
+    }
+    ret = DownloadManagerSubmitDigest(argv[1], mode, has_digest ? digest : NULL);
+    if (ret < 0) {
+        HostCmdReply("FGET,ERR,%d", ret);
+        return;
+    }
+    HostCmdReply("FGET,OK,%d", ret);
+}
+
+static void host_cmd_fota(int argc, char **argv)
+{
+    uint8_t digest[DOWNLOAD_DIGEST_SZ];
+    bool has_digest = false;
+    int ret;
+
+    if (argc < 2) {
+        HostCmdReply("FOTA,ERR,%d", -EINVAL);
+        return;
+    }
+    if (argc >= 3) {
+        if ((strlen(argv[2]) != sizeof(digest) * 2) || (HexDecode(digest, argv[2], sizeof(digest)) != 0)) {
+            HostCmdReply("FOTA,ERR,%d", -EINVAL);
+            return;
+        }
+        has_digest = true;
+    }
+    ret = DownloadManagerSubmitImage(argv[1], has_digest ? digest : NULL);
+    if (ret < 0) {
+        HostCmdReply("FOTA,ERR,%d", ret);
+        return;
+    }
+    HostCmdReply("FOTA,OK,%d", ret);
+}
+
+static void host_cmd_stat(void)
+{
+    struct download_stats st;
+
+    DownloadStatsGet(&st);
+    HostCmdReply("STAT,OK,%d,%d,%s,%d,%u,%u,%u,%u", DownloadManagerBusy(), DownloadManagerQueued(), st.file_id, st.result, st.bytes, st.elapsed_ms, st.bps, st.ttfb_ms);
+}
+
+static void host_cmd_exec(char *line)
+{
+    char *argv[ARGS_MAX];
+    int argc;
+    int err;
+
+    err = host_cmd_verify(&line[1]);
+    if (err) {
+        HostCmdReply("ERR,%d", err);
+        return;
+    }
+    argc = host_cmd_split(&line[1], argv);
+    if (argc == 0) {
+        HostCmdReply("ERR,%d", -EINVAL);
+        return;
+    }
+
+    if (strcmp(argv[0], "FGET") == 0) {
+        host_cmd_fget(argc, argv);
+    } else if (strcmp(argv[0], "FOTA") == 0) {
+        host_cmd_fota(argc, argv);
+    } else if (strcmp(argv[0], "STAT") == 0) {
+        host_cmd_stat();
+    } else if (strcmp(argv[0], "ABORT") == 0) {
+        HostCmdReply("ABORT,OK,%d", DownloadManagerAbort());
+    } else if ((strcmp(argv[0], "ECHO") == 0) && (argc >= 2)) {
+        HostCmdReply("ECHO,OK,%d", UartBrokerSetEcho(atoi(argv[1]) != 0));
+    } else {
+        HostCmdReply("%s,ERR,%d", argv[0], -ENOTSUP);
+    }
+}
+
+static void host_cmd_thread(void *arg1, void *arg2, void *arg3)
+{
+    static char line[LINE_SZ];
+
+    for (;;) {
+        if (UartBrokerReadLine(line, sizeof(line), -1) <= 0) {
+            continue;
+        }
+        if (line[0] == '$') {
+            host_cmd_exec(line);
+        } else if (line_handler != NULL) {
+            line_handler(line);
+        }
+    }
+}
+
+/** Interface **/
+
+int HostCmdReply(const char *fmt, ...)
+{
+    va_list ap;
+    int len;
+
+    k_mutex_lock(&lock_reply, K_FOREVER);
+    frame[0] = '$';
+    va_start(ap, fmt);
+    len = vsnprintf(&frame[1], sizeof(frame) - 6, fmt, ap);
+    va_end(ap);
+    if (len < 0) {
+        k_mutex_unlock(&lock_reply);
+        return len;
+    }
+    len = MIN(len, (int)sizeof(frame) - 7) + 1;
+    len += snprintf(&frame[len], sizeof(frame) - len, "*%02X\r\n", host_cmd_checksum(&frame[1], len - 1));
+    len = UartBrokerPut((uint8_t *)frame, len);
+    k_mutex_unlock(&lock_reply);
+    return len;
+}
+
+int HostCmdInit(host_cmd_line_cb_t line_cb)
+{
+    line_handler = line_cb;
+    DownloadManagerSetDoneCallback(host_cmd_done);
+    tid_hc = k_thread_create(&thread_hc, stack_hc, STACK_HC_SZ, host_cmd_thread, NULL, NULL, NULL, PRIORITY, 0, K_NO_WAIT);
+    k_thread_name_set(tid_hc, "host cmd");
+    return 0;
+}
@@ -0,0 +1,545 @@
+/*
+ * Copyright (c) 2023 SAKURA internet Inc.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/settings/settings.h>
+
+#include <modem/lte_lc.h>
+#include <modem/modem_key_mgmt.h>
+#include <modem/nrf_modem_lib.h>
+#include <modem/pdn.h>
+
+#include "app_trace.h"
+#include "boot_report.h"
+#include "lte_conn.h"
+#include "uart_broker.h"
+
+LOG_MODULE_DECLARE(sipf, CONFIG_SIPF_LOG_LEVEL);
+
+/** TLS **/
+#define TLS_SEC_TAG 42
+static const char cert[] = {
+#include "sipf/cert/sipf.iot.sakura.ad.jp"
+};
+BUILD_ASSERT(sizeof(cert) < KB(4), "Certificate too large");
+/*********/
+
+#define SEARCH_TIMEOUT_MS (CONFIG_APP_LTE_SEARCH_TIMEOUT_MS)
+#define PAUSE_MIN_MS (CONFIG_APP_LTE_RETRY_PAUSE_MS)
+#define PAUSE_MAX_MS (CONFIG_APP_LTE_RETRY_PAUSE_MAX_MS)
+
+#define LTE_EVT_REGISTERED BIT(0)
+
+static K_EVENT_DEFINE(lte_evt);
+static enum lte_conn_state lte_state = LTE_CONN_IDLE;
+/* 次の検索で優先するモード(LTE_MODE_UPDATEで実際のモードに追従) */
+static enum lte_lc_lte_mode try_mode = LTE_LC_LTE_MODE_LTEM;
+static uint32_t search_fails;
+static uint32_t pause_ms = PAUSE_MIN_MS;
+static uint32_t reconnects;
+/* 検索中に証明書を書き換えている(オフラインにしても回線断としない) */
+static bool cert_rewrite;
+
+/* RRC接続時間とPSM状態(消費電流の見積もりと送信タイミングの判断用) */
+static K_EVENT_DEFINE(rrc_evt);   /* LTE_EVT_RRC_IDLE */
+static K_EVENT_DEFINE(sleep_evt); /* LTE_EVT_AWAKE */
+#define LTE_EVT_RRC_IDLE BIT(0)
+#define LTE_EVT_AWAKE BIT(0)
+static struct k_spinlock lock_rrc;
+static bool rrc_connected;
+static int64_t rrc_since;
+static uint64_t rrc_total_ms;
+
+static void lte_conn_timeout_fn(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(lte_conn_timeout_work, lte_conn_timeout_fn);
+
+#if defined(CONFIG_APP_LTE_FAST_BOOT)
+/* 前回接続したときの情報(次回の接続を速くするため) */
+#define KEY_LAST "lte/last"
+
+struct lte_last {
+    uint8_t lte_mode; /* enum lte_lc_lte_mode */
+    uint32_t cell_id;
+    uint32_t tac;
+    uint32_t attach_ms; /* search start to registration */
+};
+
+static struct lte_last last;
+static bool last_valid;
+static struct lte_last cur;
+
+static int lte_conn_set(const char *key, size_t len, settings_read_cb read_cb, void *cb_arg)
+{
+    const char *next;
+
+    if (settings_name_steq(key, "last", &next) && (next == NULL)) {
+        if (len != sizeof(last)) {
+            return -EINVAL;
+        }
+        if (read_cb(cb_arg, &last, sizeof(last)) != sizeof(last)) {
+            return -EIO;
+        }
+        last_valid = true;
+        return 0;
+    }
+    return -ENOENT;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(lte_conn, "lte", NULL, lte_conn_set, NULL, NULL);
+
+/* 設定の書き込みはLTEのイベントハンドラの外で行う */
+static void lte_conn_save_work_fn(struct k_work *work)
+{
+    int err = settings_save_one(KEY_LAST, &cur, sizeof(cur));
+    if (err) {
+        LOG_ERR("settings_save_one(%s) failed: %d", KEY_LAST, err);
+    }
+}
+
+static K_WORK_DEFINE(lte_conn_save_work, lte_conn_save_work_fn);
+
+static void lte_conn_save_changed(void)
+{
+    if (!last_valid || (cur.lte_mode != last.lte_mode) || (cur.cell_id != last.cell_id) || (cur.tac != last.tac)) {
+        k_work_submit(&lte_conn_save_work);
+    }
+}
+
+/* ハンドラの中なのでATコマンドは使わず、LTE_MODE_UPDATEで得たモードを記録する */
+static void lte_conn_registered(void)
+{
+    cur.lte_mode = try_mode;
+    cur.attach_ms = BootReportGet(BOOT_PHASE_REGISTERED) - BootReportGet(BOOT_PHASE_SEARCH);
+    lte_conn_save_changed();
+}
+#endif
+
+static int cert_provision(void)
+{
+    int err;
+    bool exists;
+    int64_t ms_begin = k_uptime_get();
+
+    err = modem_key_mgmt_exists(TLS_SEC_TAG, MODEM_KEY_MGMT_CRED_TYPE_CA_CHAIN, &exists);
+    if (err) {
+        LOG_ERR("Failed to check for certificates err %d", err);
+        return err;
+    }
+
+    if (exists) {
+#if defined(CONFIG_APP_CERT_COMPARE)
+        /* Keep the provisioned certificate if it is the embedded one,
+         * so the modem flash is rewritten only when the cert changes.
+         */
+        err = modem_key_mgmt_cmp(TLS_SEC_TAG, MODEM_KEY_MGMT_CRED_TYPE_CA_CHAIN, cert, sizeof(cert) - 1);
+        if (err == 0) {
+            LOG_INF("Certificate is up to date (%lld ms)", k_uptime_get() - ms_begin);
+            return 0;
+        }
+        if (err < 0) {
+            LOG_WRN("Failed to compare certificate, err %d", err);
+        }
+#endif
+        /* Delete what is provisioned with our security tag
+         * and reprovision our certificate.
+         */
+        err = modem_key_mgmt_delete(TLS_SEC_TAG, MODEM_KEY_MGMT_CRED_TYPE_CA_CHAIN);
+        if (err) {
+            LOG_ERR("Failed to delete existing certificate, err %d", err);
+        }
+    }
+
+    LOG_DBG("Provisioning certificate");
+
+    /*  Provision certificate to the modem */
+    err = modem_key_mgmt_write(TLS_SEC_TAG, MODEM_KEY_MGMT_CRED_TYPE_CA_CHAIN, cert, sizeof(cert) - 1);
+    if (err) {
+        LOG_ERR("Failed to provision certificate, err %d", err);
+        return err;
+    }
+    LOG_INF("Certificate provisioned (%lld ms)", k_uptime_get() - ms_begin);
+
+    return 0;
+}
+
+#if defined(CONFIG_APP_LTE_FAST_BOOT)
+/*
+ * Runs while the modem is already searching. Reading a credential is
+ * allowed in any functional mode, but writing needs the modem offline, so
+ * the search is interrupted only when the certificate actually changed.
+ */
+static int cert_check_online(void)
+{
+    bool exists = false;
+    int err;
+
+    err = modem_key_mgmt_exists(TLS_SEC_TAG, MODEM_KEY_MGMT_CRED_TYPE_CA_CHAIN, &exists);
+    if (err) {
+        LOG_ERR("Failed to check for certificates err %d", err);
+        return err;
+    }
+#if defined(CONFIG_APP_CERT_COMPARE)
+    if (exists && (modem_key_mgmt_cmp(TLS_SEC_TAG, MODEM_KEY_MGMT_CRED_TYPE_CA_CHAIN, cert, sizeof(cert) - 1) == 0)) {
+        LOG_INF("Certificate is up to date");
+        return 0;
+    }
+#endif
+    // 証明書を書き換えるため一旦オフラインにする(回線断としては扱わない)
+    cert_rewrite = true;
+    lte_lc_offline();
+    err = cert_provision();
+    lte_lc_normal();
+    cert_rewrite = false;
+    k_work_reschedule(&lte_conn_timeout_work, K_MSEC(SEARCH_TIMEOUT_MS));
+    return err;
+}
+#endif
+
+static int lte_conn_set_mode(enum lte_lc_lte_mode mode)
+{
+    enum lte_lc_system_mode_preference pref = (mode == LTE_LC_LTE_MODE_NBIOT) ? LTE_LC_SYSTEM_MODE_PREFER_NBIOT : LTE_LC_SYSTEM_MODE_PREFER_LTEM;
+    int err = lte_lc_system_mode_set(LTE_LC_SYSTEM_MODE_LTEM_NBIOT, pref);
+
+    if (err) {
+        LOG_WRN("lte_lc_system_mode_set() failed: %d", err);
+    }
+    return err;
+}
+
+/*
+ * Search timed out (SEARCHING) or the pause is over (PAUSED). The modem is
+ * never deinitialized; it only goes offline to change the preferred mode or
+ * to rest between rounds.
+ */
+static void lte_conn_timeout_fn(struct k_work *work)
+{
+    switch (lte_state) {
+    case LTE_CONN_SEARCHING:
+        search_fails++;
+        UartBrokerPuts("TIMEOUT\r\n");
+#if defined(CONFIG_APP_LTE_MODE_FALLBACK)
+        if ((search_fails % 2) == 1) {
+            // もう一方のモードで探す
+            try_mode = (try_mode == LTE_LC_LTE_MODE_NBIOT) ? LTE_LC_LTE_MODE_LTEM : LTE_LC_LTE_MODE_NBIOT;
+            LOG_INF("Fall back to %s", (try_mode == LTE_LC_LTE_MODE_NBIOT) ? "NB-IoT" : "LTE-M");
+            lte_lc_offline();
+            lte_conn_set_mode(try_mode);
+            lte_lc_normal();
+            k_work_reschedule(&lte_conn_timeout_work, K_MSEC(SEARCH_TIMEOUT_MS));
+            break;
+        }
+#endif
+        if (pause_ms > 0) {
+            // 両方のモードで見つからなければしばらく休む
+            LOG_INF("No network, retry after %u ms", pause_ms);
+            lte_lc_offline();
+            lte_state = LTE_CONN_PAUSED;
+            k_work_reschedule(&lte_conn_timeout_work, K_MSEC(pause_ms));
+            pause_ms = MIN(pause_ms * 2, PAUSE_MAX_MS);
+            break;
+        }
+        k_work_reschedule(&lte_conn_timeout_work, K_MSEC(SEARCH_TIMEOUT_MS));
+        break;
+    case LTE_CONN_PAUSED:
+        lte_state = LTE_CONN_SEARCHING;
+        UartBrokerPrintf("Trying to attach to LTE network (TIMEOUT: %d ms)\r\n", SEARCH_TIMEOUT_MS);
+        lte_lc_normal();
+        k_work_reschedule(&lte_conn_timeout_work, K_MSEC(SEARCH_TIMEOUT_MS));
+        break;
+    default:
+        break;
+    }
+}
+
+static void lte_handler(const struct lte_lc_evt *const evt)
+{
+    switch (evt->type) {
+    case LTE_LC_EVT_NW_REG_STATUS:
+        APP_TRACE(APP_TRACE_LTE_EVT, evt->type, evt->nw_reg_status);
+        if (evt->nw_reg_status == LTE_LC_NW_REG_SEARCHING) {
+            UartBrokerPuts("SEARCHING\r\n");
+        }
+        if ((evt->nw_reg_status == LTE_LC_NW_REG_REGISTERED_HOME) || (evt->nw_reg_status == LTE_LC_NW_REG_REGISTERED_ROAMING)) {
+            UartBrokerPuts("REGISTERD\r\n");
+            BootReportMark(BOOT_PHASE_REGISTERED);
+            k_work_cancel_delayable(&lte_conn_timeout_work);
+            lte_state = LTE_CONN_REGISTERED;
+            search_fails = 0;
+            pause_ms = PAUSE_MIN_MS;
+#if defined(CONFIG_APP_LTE_FAST_BOOT)
+            lte_conn_registered();
+#endif
+            k_event_post(&lte_evt, LTE_EVT_REGISTERED);
+            break;
+        }
+        if ((lte_state == LTE_CONN_REGISTERED) && cert_rewrite) {
+            // 証明書の書き換えのためにオフラインにしただけ
+            k_event_set(&lte_evt, 0);
+            lte_state = LTE_CONN_SEARCHING;
+        } else if (lte_state == LTE_CONN_REGISTERED) {
+            // 接続が切れた: モデムは自動で再検索するのでタイムアウトだけ監視する
+            UartBrokerPuts("LTE link lost\r\n");
+            k_event_set(&lte_evt, 0);
+            lte_state = LTE_CONN_SEARCHING;
+            reconnects++;
+            k_work_reschedule(&lte_conn_timeout_work, K_MSEC(SEARCH_TIMEOUT_MS));
+        }
+        break;
+    case LTE_LC_EVT_CELL_UPDATE:
+        APP_TRACE(APP_TRACE_LTE_CELL, evt->cell.tac, evt->cell.id);
+        BootReportMark(BOOT_PHASE_CELL);
+#if defined(CONFIG_APP_LTE_FAST_BOOT)
+        cur.cell_id = evt->cell.id;
+        cur.tac = evt->cell.tac;
+#endif
+        break;
+    case LTE_LC_EVT_LTE_MODE_UPDATE:
+        APP_TRACE(APP_TRACE_LTE_EVT, evt->type, evt->lte_mode);
+        if (evt->lte_mode != LTE_LC_LTE_MODE_NONE) {
+            try_mode = evt->lte_mode;
+#if defined(CONFIG_APP_LTE_FAST_BOOT)
+            // 登録の通知より後に来た場合
+            if ((lte_state == LTE_CONN_REGISTERED) && (cur.lte_mode != try_mode)) {
+                cur.lte_mode = try_mode;
+                lte_conn_save_changed();
+            }
+#endif
+        }
+        break;
+    case LTE_LC_EVT_MODEM_EVENT:
+        APP_TRACE(APP_TRACE_LTE_EVT, evt->type, evt->modem_evt);
+        break;
+    case LTE_LC_EVT_RRC_UPDATE: {
+        k_spinlock_key_t key = k_spin_lock(&lock_rrc);
+        int64_t now = k_uptime_get();
+        bool connected = (evt->rrc_mode == LTE_LC_RRC_MODE_CONNECTED);
+
+        APP_TRACE(APP_TRACE_LTE_EVT, evt->type, evt->rrc_mode);
+        if (rrc_connected && !connected) {
+            rrc_total_ms += now - rrc_since;
+        } else if (!rrc_connected && connected) {
+            rrc_since = now;
+        }
+        rrc_connected = connected;
+        k_spin_unlock(&lock_rrc, key);
+        if (connected) {
+            k_event_set(&rrc_evt, 0);
+        } else {
+            k_event_post(&rrc_evt, LTE_EVT_RRC_IDLE);
+        }
+        break;
+    }
+    case LTE_LC_EVT_MODEM_SLEEP_ENTER:
+        APP_TRACE(APP_TRACE_LTE_SLEEP, evt->modem_sleep.type, MIN(evt->modem_sleep.time, UINT32_MAX));
+        if (evt->modem_sleep.type == LTE_LC_MODEM_SLEEP_PSM) {
+            k_event_set(&sleep_evt, 0);
+        }
+        break;
+    case LTE_LC_EVT_MODEM_SLEEP_EXIT_PRE_WARNING:
+    case LTE_LC_EVT_MODEM_SLEEP_EXIT:
+        APP_TRACE(APP_TRACE_LTE_EVT, evt->type, 0);
+        k_event_post(&sleep_evt, LTE_EVT_AWAKE);
+        break;
+    default:
+        APP_TRACE(APP_TRACE_LTE_EVT, evt->type, 0);
+        break;
+    }
+}
+
+static int lte_conn_pdn(void)
+{
+    int err;
+
+    /* PDN */
+    uint8_t cid;
+    err = pdn_ctx_create(&cid, NULL);
+    if (err != 0) {
+        LOG_ERR("Failed to pdn_ctx_create(), err %d", err);
+        return err;
+    }
+    // set APN
+    err = pdn_ctx_configure(cid, "sakura", PDN_FAM_IPV4, NULL);
+    if (err != 0) {
+        LOG_ERR("Failed to pdn_ctx_configure(), err %d", err);
+        return err;
+    }
+    LOG_DBG("Setting APN OK");
+    BootReportMark(BOOT_PHASE_PDN);
+    return 0;
+}
+
+static int lte_conn_search(void)
+{
+    int err;
+
+    LOG_DBG("Initialize LTE");
+    err = lte_lc_init();
+    if (err) {
+        LOG_ERR("Failed to initializes the modem, err %d", err);
+        return err;
+    }
+    LOG_DBG("Initialize LTE OK");
+
+    lte_lc_modem_events_enable();
+
+#if defined(CONFIG_APP_LTE_FAST_BOOT)
+    if (last_valid && (last.lte_mode != LTE_LC_LTE_MODE_NONE)) {
+        // 前回つながったモードを優先して探す
+        try_mode = last.lte_mode;
+        lte_conn_set_mode(try_mode);
+    } else if (IS_ENABLED(CONFIG_APP_LTE_MODE_FALLBACK)) {
+        lte_conn_set_mode(try_mode);
+    }
+#elif defined(CONFIG_APP_LTE_MODE_FALLBACK)
+    lte_conn_set_mode(try_mode);
+#endif
+
+    // PSMの設定(登録を待たずに使い始めることがあるので接続前に要求する)
+    err = lte_lc_psm_req(true);
+    if (err) {
+        LOG_ERR("PSM request failed, error: %d", err);
+    } else {
+        LOG_DBG("PSM is enabled");
+    }
+#if defined(CONFIG_APP_LTE_RAI)
+    // 最後のデータの後すぐにRRCを解放してもらう(機能モードを上げる前に設定する)
+    err = lte_lc_rai_req(true);
+    if (err) {
+        LOG_WRN("RAI request failed, error: %d", err);
+    } else {
+        LOG_INF("RAI is requested");
+    }
+#endif
+
+    LOG_INF("Trying to attach to LTE network (TIMEOUT: %d ms)", SEARCH_TIMEOUT_MS);
+    UartBrokerPrintf("Trying to attach to LTE network (TIMEOUT: %d ms)\r\n", SEARCH_TIMEOUT_MS);
+    lte_state = LTE_CONN_SEARCHING;
+    err = lte_lc_connect_async(lte_handler);
+    if (err) {
+        LOG_ERR("Failed to attatch to the LTE network, err %d", err);
+        lte_state = LTE_CONN_IDLE;
+        return err;
+    }
+    BootReportMark(BOOT_PHASE_SEARCH);
+    k_work_reschedule(&lte_conn_timeout_work, K_MSEC(SEARCH_TIMEOUT_MS));
+    return 0;
+}
+
+/** Interface **/
+
+int LteConnStart(void)
+{
+    int err = 0;
+
+    k_event_post(&sleep_evt, LTE_EVT_AWAKE);
+    k_event_post(&rrc_evt, LTE_EVT_RRC_IDLE);
+
+    err = nrf_modem_lib_init(NORMAL_MODE);
+    if (err) {
+        LOG_ERR("Failed to initialize modem library!");
+        return err;
+    }
+    BootReportMark(BOOT_PHASE_MODEM_INIT);
+
+#if defined(CONFIG_APP_LTE_FAST_BOOT)
+    err = settings_subsys_init();
+    if (err == 0) {
+        settings_load_subtree("lte");
+    }
+    if (last_valid) {
+        LOG_INF("Last attach: mode=%u, cell=%08x, tac=%04x, %u ms", last.lte_mode, last.cell_id, last.tac, last.attach_ms);
+    }
+
+    // 先に検索を始め、証明書の確認は検索中に行う
+    err = lte_conn_pdn();
+    if (err) {
+        return err;
+    }
+    err = lte_conn_search();
+    if (err) {
+        return err;
+    }
+    err = cert_check_online();
+    if (err) {
+        LOG_ERR("Faild to cert_provision(): %d", err);
+        return err;
+    }
+    BootReportMark(BOOT_PHASE_CERT);
+    return 0;
+#else
+    /* Provision certificates before connecting to the LTE network */
+    err = cert_provision();
+    if (err) {
+        LOG_ERR("Faild to cert_provision(): %d", err);
+        return err;
+    }
+    BootReportMark(BOOT_PHASE_CERT);
+
+    err = lte_conn_pdn();
+    if (err) {
+        return err;
+    }
+    return lte_conn_search();
+#endif
+}
+
+int LteConnWait(int timeout_ms)
+{
+    k_timeout_t timeout = (timeout_ms < 0) ? K_FOREVER : K_MSEC(timeout_ms);
+
+    if (lte_state == LTE_CONN_IDLE) {
+        return -ENOTCONN;
+    }
+    if (k_event_wait(&lte_evt, LTE_EVT_REGISTERED, false, timeout) == 0) {
+        return -EAGAIN;
+    }
+    return 0;
+}
+
+int LteConnWaitAwake(int timeout_ms)
+{
+    k_timeout_t timeout = (timeout_ms < 0) ? K_FOREVER : K_MSEC(timeout_ms);
+
+    return (k_event_wait(&sleep_evt, LTE_EVT_AWAKE, false, timeout) != 0) ? 0 : -EAGAIN;
+}
+
+int LteConnWaitRrcIdle(int timeout_ms)
+{
+    k_timeout_t timeout = (timeout_ms < 0) ? K_FOREVER : K_MSEC(timeout_ms);
+
+    return (k_event_wait(&rrc_evt, LTE_EVT_RRC_IDLE, false, timeout) != 0) ? 0 : -EAGAIN;
+}
+
+uint64_t LteConnRrcConnectedMs(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock_rrc);
+    uint64_t ms = rrc_total_ms;
+
+    if (rrc_connected) {
+        ms += k_uptime_get() - rrc_since;
+    }
+    k_spin_unlock(&lock_rrc, key);
+    return ms;
+}
+
+bool LteConnIsConnected(void)
+{
+    return lte_state == LTE_CONN_REGISTERED;
+}
+
+enum lte_conn_state LteConnGetState(void)
+{
+    return lte_state;
+}
+
+uint32_t LteConnGetReconnects(void)
+{
+    return reconnects;
+}
@@ -10,254 +10,186 @@
 #include <zephyr/drivers/gpio.h>
 #include <zephyr/logging/log.h>
 
-#include <nrf_modem_at.h>
-#include <modem/lte_lc.h>
-#include <modem/modem_info.h>
-#include <modem/modem_key_mgmt.h>
-#include <modem/nrf_modem_lib.h>
-#include <modem/pdn.h>
-#include <zephyr/net/socket.h>
-#include <zephyr/net/tls_credentials.h>
-
-#include "sipf/sipf_client_http.h"
-#include "sipf/sipf_auth.h"
-#include "sipf/sipf_file.h"
+#include "app_mem.h"
+#include "app_trace.h"
+#include "auth_cache.h"
+#include "boot_report.h"
+#include "download_cache.h"
+#include "download_checkpoint.h"
+#include "download_manifest.h"
+#include "download_manager.h"
+#include "download_pipeline.h"
+#include "download_sink.h"
+#include "download_stats.h"
+#include "flash_sink.h"
+#include "fota.h"
+#include "host_cmd.h"
+#include "lte_conn.h"
 #include "uart_broker.h"
 
 LOG_MODULE_REGISTER(sipf, CONFIG_SIPF_LOG_LEVEL);
 
 /** peripheral **/
 #define LED_HEARTBEAT_MS (500)
+#define BUTTON_DEBOUNCE_MS (CONFIG_APP_BUTTON_DEBOUNCE_MS)
 static const struct gpio_dt_spec led_boot = GPIO_DT_SPEC_GET(DT_ALIAS(led_boot), gpios);
 static const struct gpio_dt_spec led_state = GPIO_DT_SPEC_GET(DT_ALIAS(led_state), gpios);
 static const struct gpio_dt_spec btn_send = GPIO_DT_SPEC_GET(DT_ALIAS(btn_send), gpios);
+static struct gpio_callback btn_send_cb;
 
 /**********/
 
-/** TLS **/
-#define TLS_SEC_TAG 42
-static const char cert[] = {
-#include "sipf/cert/sipf.iot.sakura.ad.jp"
+/** Event loop **/
+enum app_evt_type {
+    APP_EVT_BUTTON,    /* btn_send pressed (debounced) */
+    APP_EVT_HEARTBEAT, /* LED heartbeat period */
+    APP_EVT_LINE,      /* one line received on the UART */
 };
-BUILD_ASSERT(sizeof(cert) < KB(4), "Certificate too large");
-/*********/
 
-static K_SEM_DEFINE(lte_connected, 0, 1);
-static K_SEM_DEFINE(reset_request, 0, 1);
-static const struct device *uart_dev;
+#define LINE_SZ (DOWNLOAD_FILE_ID_MAX + 8)
 
-/* Auth info */
-#define SZ_USER_NAME (255)
-#define SZ_PASSWORD (255)
-static char user_name[SZ_USER_NAME];
-static char password[SZ_PASSWORD];
+struct app_evt {
+    uint8_t type;
+    char line[LINE_SZ]; /* APP_EVT_LINE */
+};
 
-/* Initialize AT communications */
-int at_comms_init(void)
-{
-    return 0;
-}
+K_MSGQ_DEFINE(msgq_app, sizeof(struct app_evt), 4, 4);
 
-static int button_init(void)
+static void app_evt_post(uint8_t type)
 {
-    if (!device_is_ready(btn_send.port)) {
-        return -ENODEV;
-    }
-    gpio_pin_configure_dt(&btn_send, GPIO_INPUT);
+    struct app_evt evt = {.type = type};
 
-    return 0;
+    // ISR/タイマーからも呼ばれるので待たない
+    if (k_msgq_put(&msgq_app, &evt, K_NO_WAIT) != 0) {
+        LOG_WRN("event %u dropped", type);
+    }
 }
 
-/** LED **/
-static int led_init(void)
+static void heartbeat_expiry(struct k_timer *timer)
 {
-    if (!device_is_ready(led_boot.port)) {
-        return -ENODEV;
-    }
-    gpio_pin_configure_dt(&led_boot, GPIO_OUTPUT_INACTIVE);
+    app_evt_post(APP_EVT_HEARTBEAT);
+}
 
-    if (!device_is_ready(led_state.port)) {
-        return -ENODEV;
-    }
-    gpio_pin_configure_dt(&led_state, GPIO_OUTPUT_INACTIVE);
+static K_TIMER_DEFINE(timer_heartbeat, heartbeat_expiry, NULL);
 
-    return 0;
+/* 押された後、BUTTON_DEBOUNCE_MS 経ってもまだ押されていれば1回の押下とする */
+static void debounce_expiry(struct k_timer *timer)
+{
+    if (gpio_pin_get_dt(&btn_send) == 1) {
+        app_evt_post(APP_EVT_BUTTON);
+    }
 }
-/***********/
 
-/** MODEM **/
-#define REGISTER_TIMEOUT_MS (120000)
-#define REGISTER_TRY (3)
+static K_TIMER_DEFINE(timer_debounce, debounce_expiry, NULL);
 
-static int cert_provision(void)
+static void btn_send_isr(const struct device *port, struct gpio_callback *cb, gpio_port_pins_t pins)
 {
-    int err;
-    bool exists;
+    // チャタリング中は再起動される
+    k_timer_start(&timer_debounce, K_MSEC(BUTTON_DEBOUNCE_MS), K_NO_WAIT);
+}
 
-    err = modem_key_mgmt_exists(TLS_SEC_TAG, MODEM_KEY_MGMT_CRED_TYPE_CA_CHAIN, &exists);
-    if (err) {
-        LOG_ERR("Failed to check for certificates err %d", err);
-        return err;
-    }
+static void uart_stat_print(void)
+{
+    struct uart_broker_stats st;
+    uint32_t tx_sz, rx_sz;
 
-    if (exists) {
-        /* For the sake of simplicity we delete what is provisioned
-         * with our security tag and reprovision our certificate.
-         */
-        err = modem_key_mgmt_delete(TLS_SEC_TAG, MODEM_KEY_MGMT_CRED_TYPE_CA_CHAIN);
-        if (err) {
-            LOG_ERR("Failed to delete existing certificate, err %d", err);
+    for (int ch = 0; ch < UART_BROKER_CH_NUM; ch++) {
+        if (!UartBrokerChReady(ch)) {
+            continue;
         }
+        UartBrokerChGetStats(ch, &st);
+        UartBrokerChGetBufSize(ch, &tx_sz, &rx_sz);
+        UartBrokerPrintf("[%s]\r\n", (ch == UART_BROKER_CONSOLE) ? "console" : "data");
+        UartBrokerPrintf("tx: %u bytes, %u drops, hwm %u/%u, blocked %u us\r\n", st.tx_bytes, st.tx_drops, st.tx_hwm, tx_sz, st.tx_blocked_us);
+        UartBrokerPrintf("rx: %u bytes, %u drops, hwm %u/%u\r\n", st.rx_bytes, st.rx_drops, st.rx_hwm, rx_sz);
     }
+}
 
-    LOG_DBG("Provisioning certificate");
-
-    /*  Provision certificate to the modem */
-    err = modem_key_mgmt_write(TLS_SEC_TAG, MODEM_KEY_MGMT_CRED_TYPE_CA_CHAIN, cert, sizeof(cert) - 1);
-    if (err) {
-        LOG_ERR("Failed to provision certificate, err %d", err);
-        return err;
-    }
+/* UARTの'$'以外の行はイベントとしてmainに渡す(host cmdスレッドから呼ばれる) */
+static void app_line_cb(const char *line)
+{
+    struct app_evt evt = {.type = APP_EVT_LINE};
 
-    return 0;
+    strncpy(evt.line, line, sizeof(evt.line) - 1);
+    k_msgq_put(&msgq_app, &evt, K_FOREVER);
 }
+/****************/
+
+static K_SEM_DEFINE(reset_request, 0, 1);
+static const struct device *uart_dev;
+
+/* Download */
+#define DOWNLOAD_FILE_DEFAULT "sipf_file_sample.txt"
+#define CMD_GET "GET "
+#define CMD_FOTA "FOTA "
+#define CMD_STAT "STAT"
+#define CMD_STAT_UPLOAD "STAT UP"
+#define CMD_UART_STAT "UART"
+#define CMD_UART_CLEAR "UART CLR"
+#define CMD_MEM "MEM"
+#define CMD_TRACE "TRACE"
+#define CMD_CACHE "CACHE"
+#define CMD_CACHE_CLEAR "CACHE CLR"
 
-static void lte_handler(const struct lte_lc_evt *const evt)
+/* Initialize AT communications */
+int at_comms_init(void)
 {
-    LOG_DBG("evt->type=%d", evt->type);
-    switch (evt->type) {
-    case LTE_LC_EVT_NW_REG_STATUS:
-        LOG_DBG("- evt->nw_reg_status=%d\n", evt->nw_reg_status);
-        if (evt->nw_reg_status == LTE_LC_NW_REG_SEARCHING) {
-            UartBrokerPrint("SEARCHING\r\n");
-            break;
-        }
-        if ((evt->nw_reg_status == LTE_LC_NW_REG_REGISTERED_HOME) || (evt->nw_reg_status == LTE_LC_NW_REG_REGISTERED_ROAMING)) {
-            UartBrokerPrint("REGISTERD\r\n");
-            k_sem_give(&lte_connected);
-            break;
-        }
-        break;
-    case LTE_LC_EVT_CELL_UPDATE:
-        LOG_DBG("- mcc=%d, mnc=%d", evt->cell.mcc, evt->cell.mnc);
-        break;
-    case LTE_LC_EVT_LTE_MODE_UPDATE:
-        LOG_DBG("- evt->lte_mode=%d", evt->lte_mode);
-        break;
-    case LTE_LC_EVT_MODEM_EVENT:
-        LOG_DBG("- evt->modem_evt=%d", evt->modem_evt);
-        break;
-    default:
-        break;
-    }
+    // '$'コマンドはhost cmdスレッドが処理する
+    return HostCmdInit(app_line_cb);
 }
 
-static int init_modem_and_lte(void)
+static int button_init(void)
 {
-    int err = 0;
-
-    err = nrf_modem_lib_init(NORMAL_MODE);
-    if (err) {
-        LOG_ERR("Failed to initialize modem library!");
-        return err;
+    if (!device_is_ready(btn_send.port)) {
+        return -ENODEV;
     }
+    gpio_pin_configure_dt(&btn_send, GPIO_INPUT);
 
-    /* Provision certificates before connecting to the LTE network */
-    err = cert_provision();
+    int err = gpio_pin_interrupt_configure_dt(&btn_send, GPIO_INT_EDGE_TO_ACTIVE);
     if (err) {
-        LOG_ERR("Faild to cert_provision(): %d", err);
-        return err;
-    }
-
-    /* PDN */
-    uint8_t cid;
-    err = pdn_ctx_create(&cid, NULL);
-    if (err != 0) {
-        LOG_ERR("Failed to pdn_ctx_create(), err %d", err);
-        return err;
-    }
-    // set APN
-    err = pdn_ctx_configure(cid, "sakura", PDN_FAM_IPV4, NULL);
-    if (err != 0) {
-        LOG_ERR("Failed to pdn_ctx_configure(), err %d", err);
         return err;
     }
-    LOG_DBG("Setting APN OK");
-
-    /* CONNECT */
-    for (int i = 0; i < REGISTER_TRY; i++) {
-        LOG_DBG("Initialize LTE");
-        err = lte_lc_init();
-        if (err) {
-            LOG_ERR("Failed to initializes the modem, err %d", err);
-            return err;
-        }
-        LOG_DBG("Initialize LTE OK");
-
-        lte_lc_modem_events_enable();
-
-        LOG_INF("[%d] Trying to attach to LTE network (TIMEOUT: %d ms)", i, REGISTER_TIMEOUT_MS);
-        UartBrokerPrint("Trying to attach to LTE network (TIMEOUT: %d ms)\r\n", REGISTER_TIMEOUT_MS);
-        err = lte_lc_connect_async(lte_handler);
-        if (err) {
-            LOG_ERR("Failed to attatch to the LTE network, err %d", err);
-            return err;
-        }
-        err = k_sem_take(&lte_connected, K_MSEC(REGISTER_TIMEOUT_MS));
-        if (err == -EAGAIN) {
-            UartBrokerPrint("TIMEOUT\r\n");
-            lte_lc_offline();
-            lte_lc_deinit();
-            continue;
-        } else if (err == 0) {
-            // connected
-
-            // PSMの設定
-            err = lte_lc_psm_req(true);
-            if (err) {
-                LOG_ERR("PSM request failed, error: %d", err);
-            } else {
-                LOG_DBG("PSM is enabled");
-            }
-            return 0;
-        } else {
-            //
-            return err;
-        }
-    }
-
-    LOG_ERR("Faild to attach to LTE Network");
-    return -1;
+    gpio_init_callback(&btn_send_cb, btn_send_isr, BIT(btn_send.pin));
+    return gpio_add_callback(btn_send.port, &btn_send_cb);
 }
-/**********/
-
-uint8_t work_buff[1024];
 
-/**
- * ファイルダウンロードのコールバック関数
-*/
-static int cb_fileDownload(uint8_t *buff, size_t len)
+/** LED **/
+static int led_init(void)
 {
-    // ファイルの内容をHEX文字列で出力
-    for (int i = 0; i < len; i++) {
-        UartBrokerPrint("%02x", buff[i]);
+    if (!device_is_ready(led_boot.port)) {
+        return -ENODEV;
     }
-    if (len < sizeof(work_buff)) {
-        UartBrokerPuts("\r\n");
+    gpio_pin_configure_dt(&led_boot, GPIO_OUTPUT_INACTIVE);
+
+    if (!device_is_ready(led_state.port)) {
+        return -ENODEV;
     }
+    gpio_pin_configure_dt(&led_state, GPIO_OUTPUT_INACTIVE);
+
     return 0;
 }
+/***********/
 
 void main(void)
 {
     int err;
 
-    int64_t ms_now, ms_timeout;
+    struct app_evt evt;
 
+#if defined(CONFIG_APP_TRACE)
+    // トレースは最初に用意する(UartBrokerの動作も記録する)
+    AppTraceInit();
+#endif
     // UartBrokerの初期化(以降、Debug系の出力も可能)
     uart_dev = DEVICE_DT_GET(UART_LABEL);
     UartBrokerInit(uart_dev);
-    UartBrokerPrint("*** SIPF SDK Sample for nRFConnect\r\n");
+    UartBrokerPuts("*** SIPF SDK Sample for nRFConnect\r\n");
+#if defined(CONFIG_UART_BROKER_DATA) && DT_NODE_HAS_STATUS(UART_DATA_LABEL, okay)
+    // ダウンロードデータは2本目のUARTに出す
+    if (UartBrokerChInit(UART_BROKER_DATA, DEVICE_DT_GET(UART_DATA_LABEL), UART_BROKER_QOS_BULK) != 0) {
+        UartBrokerPuts("* Data UART is not available.\r\n");
+    }
+#endif
 
 #ifdef CONFIG_LTE_LOCK_PLMN
     UartBrokerPuts("* PLMN: " CONFIG_LTE_LOCK_PLMN_STRING "\r\n");
@@ -268,6 +200,39 @@ void main(void)
 #ifdef CONFIG_SIPF_CONNECTOR_DISABLE_SSL
     UartBrokerPuts("* Disable SSL, CONNECTOR endpoint.\r\n");
 #endif
+#if defined(CONFIG_APP_FLASH_SINK)
+    // ダウンロードファイルの保存先
+    if (FlashSinkInit() != 0) {
+        UartBrokerPuts("* Flash sink is not available.\r\n");
+        DownloadSinkSetStore(false);
+    }
+#endif
+#if defined(CONFIG_APP_FOTA)
+    FotaInit();
+#endif
+    if (AuthCacheInit() != 0) {
+        UartBrokerPuts("* Auth cache is not available.\r\n");
+    }
+#if defined(CONFIG_APP_DOWNLOAD_RESUME)
+    // 中断したダウンロードのチェックポイントを読み込む
+    if (DownloadCheckpointInit() != 0) {
+        UartBrokerPuts("* Download checkpoint is not available.\r\n");
+    }
+#endif
+#if defined(CONFIG_APP_DOWNLOAD_DELTA)
+    // 差分書き込み用のマニフェスト
+    if (DownloadManifestInit() != 0) {
+        UartBrokerPuts("* Download manifest is not available.\r\n");
+    }
+#endif
+#if defined(CONFIG_APP_DOWNLOAD_CACHE)
+    // ダウンロード済みファイルのメタデータ
+    if (DownloadCacheInit() != 0) {
+        UartBrokerPuts("* Download cache is not available.\r\n");
+    }
+#endif
+    DownloadPipelineInit();
+
     // LEDの初期化
     led_init();
     gpio_pin_set_dt(&led_boot, 1);
@@ -279,65 +244,104 @@ void main(void)
     }
 
     //モデムの初期化&LTE接続
-    err = init_modem_and_lte();
+    err = LteConnStart();
     if (err) {
         goto err;
     }
 
-    // 認証モードをSIM認証にする
-    for (;;) {
-        UartBrokerPuts("Set AuthMode to `SIM Auth'... \r\n");
-        err = SipfAuthRequest(user_name, sizeof(user_name), password, sizeof(user_name));
-        LOG_DBG("SipfAuthRequest(): %d", err);
+    // 認証情報(キャッシュが有効ならLTEの登録を待たずにそれを使う)
+    if (AuthCacheSetup() < 0) {
+        // 取り直すには回線が必要
+        err = LteConnWait(-1);
+        if (err) {
+            goto err;
+        }
+        err = AuthCacheRefresh();
         if (err < 0) {
-            // IPアドレス認証に失敗した
-            UartBrokerPuts("faild(Retry after 10s)\r\n");
-            k_sleep(K_MSEC(10000));
-            continue;
+            // 認証情報の設定に失敗した
+            goto err;
         }
-        UartBrokerPuts("OK\r\n");
-        break;
-    }
-    err = SipfClientHttpSetAuthInfo(user_name, password);
-    if (err < 0) {
-        // 認証情報の設定に失敗した
-        goto err;
     }
+    BootReportMark(BOOT_PHASE_AUTH);
+#if defined(CONFIG_APP_FOTA)
+    // LTE接続と認証ができたら新しいイメージを確定する
+    FotaConfirm();
+#endif
 
+    DownloadManagerInit();
+
+    BootReportMark(BOOT_PHASE_READY);
+    BootReportPrint();
     UartBrokerPuts("+++ Ready +++\r\n");
     gpio_pin_set_dt(&led_state, 1);
-    ms_timeout = k_uptime_get() + LED_HEARTBEAT_MS;
+    k_timer_start(&timer_heartbeat, K_MSEC(LED_HEARTBEAT_MS), K_MSEC(LED_HEARTBEAT_MS));
+    at_comms_init();
 
-    int btn_prev = 0;
     for (;;) {
-        // Heart Beat
-        ms_now = k_uptime_get();
-        if ((ms_timeout - ms_now) < 0) {
-            ms_timeout = ms_now + LED_HEARTBEAT_MS;
-            gpio_pin_toggle_dt(&led_state);
-        }
-
-        int btn_val = gpio_pin_get_dt(&btn_send);
-        if (btn_val < 0) {
-            LOG_ERR("button_read() failed.");
-        } else {
-            if ((btn_prev == 0) && (btn_val == 1)) {
-                UartBrokerPuts("File download Button Pushed\r\n");
-                // 受信ボタンが押された
-                int recv_len;
+        // イベントが来るまで寝ている
+        k_msgq_get(&msgq_app, &evt, K_FOREVER);
+        switch (evt.type) {
+        case APP_EVT_HEARTBEAT:
+            // Heart Beat(ダウンロード中は点灯)
+            if (DownloadManagerBusy()) {
                 gpio_pin_set_dt(&led_state, 1);
-                recv_len = SipfFileDownload("sipf_file_sample.txt", NULL, sizeof(work_buff), cb_fileDownload);
-                if (recv_len < 0) {
-                    UartBrokerPuts("FAILED\r\n");
+            } else {
+                gpio_pin_toggle_dt(&led_state);
+            }
+            break;
+        case APP_EVT_BUTTON:
+            UartBrokerPuts("File download Button Pushed\r\n");
+            // 受信ボタンが押された
+            if (DownloadManagerSubmit(DOWNLOAD_FILE_DEFAULT) < 0) {
+                UartBrokerPuts("Download queue is full\r\n");
+            }
+            break;
+        case APP_EVT_LINE:
+            // UARTからのダウンロード要求(GET <file_id>)
+            if (strncmp(evt.line, CMD_GET, strlen(CMD_GET)) == 0) {
+                err = DownloadManagerSubmit(&evt.line[strlen(CMD_GET)]);
+                if (err < 0) {
+                    UartBrokerPrintf("NG %d\r\n", err);
                 } else {
-                    UartBrokerPrint("Received: %d bytes.\r\n", recv_len);
+                    UartBrokerPrintf("OK queued %d\r\n", err);
                 }
-                gpio_pin_set_dt(&led_state, 0);
+            } else if (strncmp(evt.line, CMD_FOTA, strlen(CMD_FOTA)) == 0) {
+                // ファームウェア更新(FOTA <file_id>)
+                err = DownloadManagerSubmitImage(&evt.line[strlen(CMD_FOTA)], NULL);
+                UartBrokerPrintf((err < 0) ? "NG %d\r\n" : "OK queued %d\r\n", err);
+            } else if (strcmp(evt.line, CMD_STAT_UPLOAD) == 0) {
+                // 直近のダウンロードの計測値をSIPFへアップロード
+                err = DownloadManagerSubmitStatsUpload();
+                UartBrokerPrintf((err < 0) ? "NG %d\r\n" : "OK queued %d\r\n", err);
+            } else if (strcmp(evt.line, CMD_STAT) == 0) {
+                DownloadStatsPrint();
+            } else if (strcmp(evt.line, CMD_UART_STAT) == 0) {
+                uart_stat_print();
+            } else if (strcmp(evt.line, CMD_UART_CLEAR) == 0) {
+                for (int ch = 0; ch < UART_BROKER_CH_NUM; ch++) {
+                    UartBrokerChResetStats(ch);
+                }
+                UartBrokerPuts("OK\r\n");
+            } else if (strcmp(evt.line, CMD_MEM) == 0) {
+                // バッファ領域とスタックの使用量
+                AppMemPrint();
+#if defined(CONFIG_APP_TRACE)
+            } else if (strcmp(evt.line, CMD_TRACE) == 0) {
+                // バイナリトレースの出力(scripts/trace_decode.py で読む)
+                AppTraceDump();
+#endif
+#if defined(CONFIG_APP_DOWNLOAD_CACHE)
+            } else if (strcmp(evt.line, CMD_CACHE) == 0) {
+                DownloadCachePrint();
+            } else if (strcmp(evt.line, CMD_CACHE_CLEAR) == 0) {
+                // 次の要求は必ずダウンロードする
+                UartBrokerPuts((DownloadCacheClear() == 0) ? "OK\r\n" : "NG\r\n");
+#endif
             }
-            btn_prev = btn_val;
+            break;
+        default:
+            break;
         }
-
-        k_sleep(K_MSEC(10));
     }
 err:
     for (;;) {
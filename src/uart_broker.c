@@ -9,132 +9,734 @@
 #include <string.h>
 
 #include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/cbprintf.h>
+#include <zephyr/sys/ring_buffer.h>
 
+#include "app_mem.h"
+#include "app_trace.h"
 #include "uart_broker.h"
 
 #define PRIORITY (7)
-#define STACK_UB_SZ (1024)
+#define PRIORITY_BULK (9)
+#define STACK_UB_SZ (CONFIG_UART_BROKER_STACK_SIZE)
+#define RX_DMA_SZ (CONFIG_UART_BROKER_RX_DMA_BUF_SIZE)
 
-static uint8_t tx_buff[UART_TX_BUF_SZ];
-static uint8_t rx_buff[UART_RX_BUF_SZ];
+/* 書き込みが送信待ちする最大時間 */
+#define TX_WAIT_MS (10)
+#if defined(CONFIG_UART_BROKER_DATA)
+#define TX_WAIT_BULK_MS (CONFIG_UART_BROKER_BULK_TIMEOUT_MS)
+#else
+#define TX_WAIT_BULK_MS (TX_WAIT_MS)
+#endif
 
-static bool is_echo = true;
-K_MUTEX_DEFINE(mutex_is_echo);
+/* UARTイベントのトレース: a の bit15 がチャンネル */
+#define UB_TRACE(ub, id, a, b) APP_TRACE((id), (uint16_t)(a) | ((ub)->ch << 15), (b))
 
-static struct k_msgq msgq_tx, msgq_rx;
+BUILD_ASSERT((UART_RX_BUF_SZ & (UART_RX_BUF_SZ - 1)) == 0, "UART_RX_BUF_SZ must be a power of two");
+#if defined(CONFIG_UART_BROKER_DATA)
+BUILD_ASSERT((UART_DATA_RX_BUF_SZ & (UART_DATA_RX_BUF_SZ - 1)) == 0, "UART_DATA_RX_BUF_SZ must be a power of two");
+#endif
 
-K_THREAD_STACK_DEFINE(stack_ub, STACK_UB_SZ);
-static struct k_thread thread_ub;
-static k_tid_t tid_ub;
+struct uart_broker {
+    const struct device *uart;
+    uint8_t ch;
+    bool ready;
+    enum uart_broker_qos qos;
+    atomic_t is_echo;
 
+    /*
+     * RX: lock-free SPSC ring. The UART ISR is the only producer (rx_head) and
+     * the reader API is the only consumer (rx_tail), so neither side locks.
+     */
+    uint8_t *rx_ring; /* rx_sz, from the arena */
+    uint32_t rx_sz;
+    atomic_t rx_head;
+    atomic_t rx_tail;
+    struct k_sem sem_rx;
+
+    uint32_t tx_sz;
+#if defined(CONFIG_UART_BROKER_TX_ASYNC)
+    /*
+     * TX: UartBrokerPut() copies into ring_tx and the longest contiguous span of
+     * the ring is handed to uart_tx() (EasyDMA). UART_TX_DONE releases the span
+     * and starts the next burst, so no thread is needed on the TX side.
+     */
+    struct ring_buf ring_tx;
+    struct k_spinlock lock_tx;
+    bool tx_busy;
+    uint32_t tx_start_cyc;
+    struct k_sem sem_tx_space;
+
+    uint8_t *rx_dma_buff[2];
+    uint8_t rx_dma_next;
+#else
+    uint8_t *tx_buff;
+    struct k_msgq msgq_tx;
+    struct k_thread thread_ub;
+#endif
+
+    /* TX engine activity (wakeups / active time) */
+    struct k_spinlock lock_act;
+    uint32_t act_wakeups;
+    uint64_t act_active_cyc;
+    int64_t act_since_ms;
+
+    /* Queue statistics (updated from ISRs and any writer thread) */
+    atomic_t st_tx_bytes;
+    atomic_t st_tx_drops;
+    atomic_t st_tx_hwm;
+    atomic_t st_tx_blocked_us;
+    atomic_t st_rx_bytes;
+    atomic_t st_rx_drops;
+    atomic_t st_rx_hwm;
+};
+
+/* arena owner names per channel: rx ring, tx buffer, rx dma */
+static const char *const ub_owner[UART_BROKER_CH_NUM][3] = {
+    [UART_BROKER_CONSOLE] = {"uart rx ring", "uart tx ring", "uart rx dma"},
+#if defined(CONFIG_UART_BROKER_DATA)
+    [UART_BROKER_DATA] = {"data rx ring", "data tx ring", "data rx dma"},
+#endif
+};
+
+static struct uart_broker brokers[UART_BROKER_CH_NUM];
+
+#if !defined(CONFIG_UART_BROKER_TX_ASYNC)
+K_THREAD_STACK_ARRAY_DEFINE(stack_ub, UART_BROKER_CH_NUM, STACK_UB_SZ);
+#endif
+
+/* 未初期化のチャンネルへの出力はコンソールに回す */
+static struct uart_broker *uart_broker_lookup(enum uart_broker_ch ch)
+{
+    if ((ch < UART_BROKER_CH_NUM) && brokers[ch].ready) {
+        return &brokers[ch];
+    }
+    return &brokers[UART_BROKER_CONSOLE];
+}
+
+static void uart_broker_stat_max(atomic_t *hwm, uint32_t used)
+{
+    atomic_val_t cur;
+
+    do {
+        cur = atomic_get(hwm);
+        if ((uint32_t)cur >= used) {
+            return;
+        }
+    } while (!atomic_cas(hwm, cur, (atomic_val_t)used));
+}
+
+static void uart_broker_account(struct uart_broker *ub, uint32_t wakeups, uint32_t active_cyc)
+{
+    k_spinlock_key_t key = k_spin_lock(&ub->lock_act);
+    ub->act_wakeups += wakeups;
+    ub->act_active_cyc += active_cyc;
+    k_spin_unlock(&ub->lock_act, key);
+}
+
+static k_timeout_t uart_broker_tx_wait(const struct uart_broker *ub)
+{
+    return K_MSEC((ub->qos == UART_BROKER_QOS_BULK) ? TX_WAIT_BULK_MS : TX_WAIT_MS);
+}
+
+/* ISR context. Stores as much as fits and returns the stored length. */
+static uint32_t uart_broker_rx_push(struct uart_broker *ub, const uint8_t *data, uint32_t len)
+{
+    uint32_t head = (uint32_t)atomic_get(&ub->rx_head);
+    uint32_t space = ub->rx_sz - (head - (uint32_t)atomic_get(&ub->rx_tail));
+    uint32_t n = MIN(len, space);
+    uint32_t idx = head & (ub->rx_sz - 1);
+    uint32_t first = MIN(n, ub->rx_sz - idx);
+
+    memcpy(&ub->rx_ring[idx], data, first);
+    memcpy(ub->rx_ring, &data[first], n - first);
+    // データを書いてからheadを進める
+    atomic_set(&ub->rx_head, (atomic_val_t)(head + n));
+    atomic_add(&ub->st_rx_bytes, n);
+    UB_TRACE(ub, APP_TRACE_UART_RX, n, 0);
+    if (n < len) {
+        // 読み出しが追いつかず溢れた
+        atomic_add(&ub->st_rx_drops, len - n);
+        UB_TRACE(ub, APP_TRACE_UART_DROP, 1, len - n);
+    }
+    uart_broker_stat_max(&ub->st_rx_hwm, ub->rx_sz - space + n);
+    if (n > 0) {
+        k_sem_give(&ub->sem_rx);
+    }
+    return n;
+}
+
+static uint32_t uart_broker_rx_avail(struct uart_broker *ub, uint32_t tail)
+{
+    return (uint32_t)atomic_get(&ub->rx_head) - tail;
+}
+
+static void uart_broker_rx_copy(struct uart_broker *ub, uint8_t *dst, uint32_t tail, uint32_t len)
+{
+    uint32_t idx = tail & (ub->rx_sz - 1);
+    uint32_t first = MIN(len, ub->rx_sz - idx);
+
+    memcpy(dst, &ub->rx_ring[idx], first);
+    memcpy(&dst[first], ub->rx_ring, len - first);
+}
+
+/* Offset of the first `c` within the readable data, or -1 */
+static int uart_broker_rx_find(struct uart_broker *ub, uint8_t c, uint32_t tail, uint32_t avail)
+{
+    uint32_t idx = tail & (ub->rx_sz - 1);
+    uint32_t first = MIN(avail, ub->rx_sz - idx);
+    uint8_t *p;
+
+    p = memchr(&ub->rx_ring[idx], c, first);
+    if (p != NULL) {
+        return p - &ub->rx_ring[idx];
+    }
+    p = memchr(ub->rx_ring, c, avail - first);
+    if (p != NULL) {
+        return first + (p - ub->rx_ring);
+    }
+    return -1;
+}
+
+/* Wait until more than `have` bytes are readable. timeout_ms < 0 waits forever. */
+static int uart_broker_rx_wait(struct uart_broker *ub, uint32_t have, int timeout_ms)
+{
+    int64_t end = k_uptime_get() + timeout_ms;
+
+    while (uart_broker_rx_avail(ub, (uint32_t)atomic_get(&ub->rx_tail)) <= have) {
+        k_timeout_t tmo = K_FOREVER;
+        if (timeout_ms >= 0) {
+            int64_t remain = end - k_uptime_get();
+            if (remain <= 0) {
+                return -EAGAIN;
+            }
+            tmo = K_MSEC(remain);
+        }
+        if (k_sem_take(&ub->sem_rx, tmo) != 0) {
+            return -EAGAIN;
+        }
+    }
+    return 0;
+}
+
+#if defined(CONFIG_UART_BROKER_TX_ASYNC)
+/* lock_tx must be held */
+static void uart_broker_tx_kick(struct uart_broker *ub)
+{
+    uint8_t *data;
+    uint32_t len;
+
+    if (ub->tx_busy) {
+        return;
+    }
+    len = ring_buf_get_claim(&ub->ring_tx, &data, ub->tx_sz);
+    if (len == 0) {
+        return;
+    }
+    if (uart_tx(ub->uart, data, len, SYS_FOREVER_US) == 0) {
+        ub->tx_busy = true;
+        ub->tx_start_cyc = k_cycle_get_32();
+        UB_TRACE(ub, APP_TRACE_UART_TX, len, 0);
+    } else {
+        // 送信できなかったのでclaimを戻す
+        ring_buf_get_finish(&ub->ring_tx, 0);
+    }
+}
+
+/*
+ * Put as much as fits without blocking. Returns the number of bytes queued.
+ * With kick == false the data is only queued; the next kick sends it.
+ */
+static uint32_t uart_broker_tx_put(struct uart_broker *ub, const uint8_t *data, uint32_t len, bool kick)
+{
+    k_spinlock_key_t key = k_spin_lock(&ub->lock_tx);
+    uint32_t n = ring_buf_put(&ub->ring_tx, data, len);
+    if (kick || (n < len)) {
+        uart_broker_tx_kick(ub);
+    }
+    uart_broker_stat_max(&ub->st_tx_hwm, ring_buf_size_get(&ub->ring_tx));
+    k_spin_unlock(&ub->lock_tx, key);
+    atomic_add(&ub->st_tx_bytes, n);
+    return n;
+}
+
+/* Queue `len` bytes, waiting for TX space (10 ms per stall, or the bulk timeout) */
+static int uart_broker_tx_write(struct uart_broker *ub, const uint8_t *data, int len, bool kick)
+{
+    int cnt = 0;
+    while (cnt < len) {
+        uint32_t n = uart_broker_tx_put(ub, &data[cnt], len - cnt, kick);
+        cnt += n;
+        if ((cnt < len) && (n == 0)) {
+            // リングが一杯なので送信完了を待つ
+            if (k_is_in_isr()) {
+                break;
+            }
+            uint32_t t = k_cycle_get_32();
+            int err = k_sem_take(&ub->sem_tx_space, uart_broker_tx_wait(ub));
+            atomic_add(&ub->st_tx_blocked_us, k_cyc_to_us_floor32(k_cycle_get_32() - t));
+            if (err != 0) {
+                break;
+            }
+        }
+    }
+    if (cnt < len) {
+        atomic_add(&ub->st_tx_drops, len - cnt);
+        UB_TRACE(ub, APP_TRACE_UART_DROP, 0, len - cnt);
+    }
+    return cnt;
+}
+
+static void uart_broker_tx_flush(struct uart_broker *ub)
+{
+    k_spinlock_key_t key = k_spin_lock(&ub->lock_tx);
+    uart_broker_tx_kick(ub);
+    k_spin_unlock(&ub->lock_tx, key);
+}
+
+static void uart_broker_async_cb(const struct device *uart, struct uart_event *evt, void *user_data)
+{
+    struct uart_broker *ub = user_data;
+    k_spinlock_key_t key;
+
+    switch (evt->type) {
+    case UART_TX_DONE:
+    case UART_TX_ABORTED:
+        key = k_spin_lock(&ub->lock_tx);
+        ring_buf_get_finish(&ub->ring_tx, evt->data.tx.len);
+        ub->tx_busy = false;
+        uart_broker_account(ub, 1, k_cycle_get_32() - ub->tx_start_cyc);
+        UB_TRACE(ub, APP_TRACE_UART_TX_DONE, evt->data.tx.len, k_cycle_get_32() - ub->tx_start_cyc);
+        uart_broker_tx_kick(ub);
+        k_spin_unlock(&ub->lock_tx, key);
+        k_sem_give(&ub->sem_tx_space);
+        break;
+    case UART_RX_RDY:
+        uart_broker_rx_push(ub, &evt->data.rx.buf[evt->data.rx.offset], evt->data.rx.len);
+        // ECHO BACK
+        if (atomic_get(&ub->is_echo)) {
+            uint32_t n = uart_broker_tx_put(ub, &evt->data.rx.buf[evt->data.rx.offset], evt->data.rx.len, true);
+            if (n < evt->data.rx.len) {
+                atomic_add(&ub->st_tx_drops, evt->data.rx.len - n);
+            }
+        }
+        break;
+    case UART_RX_BUF_REQUEST:
+        uart_rx_buf_rsp(uart, ub->rx_dma_buff[ub->rx_dma_next], RX_DMA_SZ);
+        ub->rx_dma_next ^= 1;
+        break;
+    case UART_RX_DISABLED:
+        // 受信が止まったら再開する
+        uart_rx_enable(uart, ub->rx_dma_buff[ub->rx_dma_next], RX_DMA_SZ, CONFIG_UART_BROKER_RX_TIMEOUT_US);
+        ub->rx_dma_next ^= 1;
+        break;
+    default:
+        break;
+    }
+}
+#else
 static void uart_broker_fifo_cb(const struct device *uart, void *user_data)
 {
-    ARG_UNUSED(user_data);
+    struct uart_broker *ub = user_data;
 
     if (uart_irq_update(uart) != 1) {
         return;
     }
 
-    if (uart_irq_rx_ready(uart) == 1) {
-        bool e;
-        uint8_t b;
-        uart_fifo_read(uart, &b, 1);
-        k_msgq_put(&msgq_rx, &b, K_NO_WAIT);
-        // ECHO BACK
-        k_mutex_lock(&mutex_is_echo, K_FOREVER);
-        e = is_echo;
-        k_mutex_unlock(&mutex_is_echo);
-        if (e) {
-            uart_poll_out(uart, b); // ECHO BACK
+    // HW FIFOが空になるまで読む
+    while (uart_irq_rx_ready(uart) == 1) {
+        uint8_t buf[16];
+        int n = uart_fifo_read(uart, buf, sizeof(buf));
+        if (n <= 0) {
+            break;
+        }
+        uart_broker_rx_push(ub, buf, n);
+        // ECHO BACK (ISR内でブロックしないよう送信キュー経由)
+        if (atomic_get(&ub->is_echo)) {
+            for (int i = 0; i < n; i++) {
+                if (k_msgq_put(&ub->msgq_tx, &buf[i], K_NO_WAIT) == 0) {
+                    atomic_inc(&ub->st_tx_bytes);
+                } else {
+                    atomic_inc(&ub->st_tx_drops);
+                }
+            }
+            uart_broker_stat_max(&ub->st_tx_hwm, k_msgq_num_used_get(&ub->msgq_tx));
         }
     }
 }
 
-static void uart_broker_thread(void *dev, void *arg2, void *arg3)
+static void uart_broker_thread(void *arg1, void *arg2, void *arg3)
 {
-    const struct device *uart = (struct device *)dev;
+    struct uart_broker *ub = arg1;
     uint8_t b;
+    uint32_t t;
+    uint32_t n;
 
-    uart_irq_callback_set(uart, uart_broker_fifo_cb);
-    uart_irq_rx_enable(uart);
+    uart_irq_callback_user_data_set(ub->uart, uart_broker_fifo_cb, ub);
+    uart_irq_rx_enable(ub->uart);
 
     for (;;) {
-        // TX
-        while (k_msgq_get(&msgq_tx, &b, K_USEC(1)) == 0) {
-            // 送信キューになにか入ってた
-            uart_poll_out(uart, b);
-        }
+        // 送信データが来るまで寝る
+        k_msgq_get(&ub->msgq_tx, &b, K_FOREVER);
+        t = k_cycle_get_32();
+        n = 0;
+        // TX: キューが空になるまで送る
+        do {
+            uart_poll_out(ub->uart, b);
+            n++;
+        } while (k_msgq_get(&ub->msgq_tx, &b, K_NO_WAIT) == 0);
+        uart_broker_account(ub, 1, k_cycle_get_32() - t);
+        UB_TRACE(ub, APP_TRACE_UART_TX_DONE, n, k_cycle_get_32() - t);
     }
 }
 
-/** Interface **/
-int UartBrokerPutByte(uint8_t byte)
+static int uart_broker_put_byte(struct uart_broker *ub, uint8_t byte)
 {
-    return k_msgq_put(&msgq_tx, &byte, K_MSEC(10));
+    int err = k_msgq_put(&ub->msgq_tx, &byte, K_NO_WAIT);
+
+    if ((err != 0) && !k_is_in_isr()) {
+        // キューが一杯なら最大10ms(バルクは設定値)待つ
+        uint32_t t = k_cycle_get_32();
+        err = k_msgq_put(&ub->msgq_tx, &byte, uart_broker_tx_wait(ub));
+        atomic_add(&ub->st_tx_blocked_us, k_cyc_to_us_floor32(k_cycle_get_32() - t));
+    }
+    if (err != 0) {
+        atomic_inc(&ub->st_tx_drops);
+        return err;
+    }
+    atomic_inc(&ub->st_tx_bytes);
+    uart_broker_stat_max(&ub->st_tx_hwm, k_msgq_num_used_get(&ub->msgq_tx));
+    return 0;
 }
+#endif
 
-int UartBrokerPut(uint8_t *data, int len)
+static int uart_broker_put(struct uart_broker *ub, uint8_t *data, int len)
 {
+#if defined(CONFIG_UART_BROKER_TX_ASYNC)
+    return uart_broker_tx_write(ub, data, len, true);
+#else
     int cnt = 0;
     int ret;
     for (int i = 0; i < len; i++) {
-        ret = UartBrokerPutByte(data[i]);
+        ret = uart_broker_put_byte(ub, data[i]);
         if (ret != 0) {
+            // 残りも送れなかった分として数える
+            atomic_add(&ub->st_tx_drops, len - i - 1);
+            UB_TRACE(ub, APP_TRACE_UART_DROP, 0, len - i);
             break;
         }
         cnt++;
     }
     return cnt;
+#endif
 }
 
-int UartBrokerPuts(const char *msg)
-{
-    return UartBrokerPut((uint8_t *)msg, strlen(msg));
-}
+struct uart_broker_printf_ctx {
+    struct uart_broker *ub;
+    int len;
+    bool full;
+};
 
-int UartBrokerGetByte(uint8_t *byte)
+/* cbvprintf() output: one character straight into the TX queue */
+static int uart_broker_printf_cb(int c, void *user_data)
 {
-    return k_msgq_get(&msgq_rx, byte, K_MSEC(1));
+    struct uart_broker_printf_ctx *ctx = user_data;
+    uint8_t b = (uint8_t)c;
+
+    if (ctx->full) {
+        atomic_inc(&ctx->ub->st_tx_drops);
+        return c;
+    }
+    if (ctx->len >= UART_BROKER_PRINTF_MAX) {
+        return c;
+    }
+#if defined(CONFIG_UART_BROKER_TX_ASYNC)
+    if (uart_broker_tx_write(ctx->ub, &b, 1, false) != 1) {
+#else
+    if (uart_broker_put_byte(ctx->ub, b) != 0) {
+#endif
+        // 送信キューが詰まったら残りは捨てる
+        ctx->full = true;
+        return c;
+    }
+    ctx->len++;
+    return c;
 }
 
-int UartBrokerGetByteTm(uint8_t *byte, int timeout_ms)
+static int uart_broker_vprintf(struct uart_broker *ub, const char *fmt, va_list ap)
 {
-    return k_msgq_get(&msgq_rx, byte, K_MSEC(timeout_ms));
+    struct uart_broker_printf_ctx ctx = {.ub = ub};
+
+    cbvprintf(uart_broker_printf_cb, &ctx, fmt, ap);
+#if defined(CONFIG_UART_BROKER_TX_ASYNC)
+    uart_broker_tx_flush(ub);
+#endif
+    return ctx.len;
 }
 
-void UartBrokerClearRecveiveQueue(void)
+static int uart_broker_get_bulk(struct uart_broker *ub, uint8_t **data, int timeout_ms)
 {
-    k_msgq_purge(&msgq_rx);
+    uint32_t tail;
+    uint32_t avail;
+
+    if (uart_broker_rx_wait(ub, 0, timeout_ms) != 0) {
+        return 0;
+    }
+    tail = (uint32_t)atomic_get(&ub->rx_tail);
+    avail = uart_broker_rx_avail(ub, tail);
+    *data = &ub->rx_ring[tail & (ub->rx_sz - 1)];
+    return MIN(avail, ub->rx_sz - (tail & (ub->rx_sz - 1)));
 }
 
-int UartBrokerGet(uint8_t *data, int len)
+static int uart_broker_get(struct uart_broker *ub, uint8_t *data, int len)
 {
     int cnt = 0;
-    int ret;
-    for (int i = 0; i < len; i++) {
-        ret = UartBrokerGetByte(&data[i]);
-        if (ret != 0) {
+    while (cnt < len) {
+        uint8_t *span;
+        int n = uart_broker_get_bulk(ub, &span, 1);
+        if (n <= 0) {
             break;
         }
-        cnt++;
+        n = MIN(n, len - cnt);
+        memcpy(&data[cnt], span, n);
+        atomic_add(&ub->rx_tail, n);
+        cnt += n;
     }
     return cnt;
 }
 
-int UartBrokerInit(const struct device *uart)
+static int uart_broker_read_line(struct uart_broker *ub, char *line, int size, int timeout_ms)
+{
+    if (size < 1) {
+        return -EINVAL;
+    }
+    for (;;) {
+        uint32_t tail = (uint32_t)atomic_get(&ub->rx_tail);
+        uint32_t avail = uart_broker_rx_avail(ub, tail);
+        int pos = uart_broker_rx_find(ub, '\n', tail, avail);
+        uint32_t len;
+        uint32_t consume;
+
+        if (pos >= 0) {
+            // 1行揃った
+            len = MIN((uint32_t)pos, (uint32_t)size - 1);
+            consume = pos + 1;
+        } else if ((avail >= (uint32_t)size - 1) || (avail >= ub->rx_sz)) {
+            // 改行が来る前にバッファが一杯になった
+            len = MIN(avail, (uint32_t)size - 1);
+            consume = len;
+        } else {
+            if (uart_broker_rx_wait(ub, avail, timeout_ms) != 0) {
+                return -EAGAIN;
+            }
+            continue;
+        }
+
+        uart_broker_rx_copy(ub, (uint8_t *)line, tail, len);
+        atomic_add(&ub->rx_tail, consume);
+        if ((len > 0) && (line[len - 1] == '\r')) {
+            len--;
+        }
+        line[len] = '\0';
+        return len;
+    }
+}
+
+/* Buffers sized by UART_BROKER_ARENA_SZ */
+static int uart_broker_alloc(struct uart_broker *ub)
+{
+    const char *const *owner = ub_owner[ub->ch];
+
+    if (ub->rx_ring != NULL) {
+        return 0;
+    }
+    ub->rx_ring = AppArenaAlloc(ub->rx_sz, owner[0]);
+#if defined(CONFIG_UART_BROKER_TX_ASYNC)
+    uint8_t *tx = AppArenaAlloc(ub->tx_sz, owner[1]);
+    ub->rx_dma_buff[0] = AppArenaAlloc(RX_DMA_SZ, owner[2]);
+    ub->rx_dma_buff[1] = AppArenaAlloc(RX_DMA_SZ, owner[2]);
+    if ((tx == NULL) || (ub->rx_dma_buff[0] == NULL) || (ub->rx_dma_buff[1] == NULL)) {
+        return -ENOMEM;
+    }
+    ring_buf_init(&ub->ring_tx, ub->tx_sz, tx);
+#else
+    ub->tx_buff = AppArenaAlloc(ub->tx_sz, owner[1]);
+    if (ub->tx_buff == NULL) {
+        return -ENOMEM;
+    }
+#endif
+    return (ub->rx_ring != NULL) ? 0 : -ENOMEM;
+}
+
+static int uart_broker_init(struct uart_broker *ub, const struct device *uart)
 {
-    // 送受信キュー作成
-    k_msgq_init(&msgq_tx, tx_buff, 1, UART_TX_BUF_SZ);
-    k_msgq_init(&msgq_rx, rx_buff, 1, UART_RX_BUF_SZ);
+    ub->act_since_ms = k_uptime_get();
+    if (uart_broker_alloc(ub) != 0) {
+        return -ENOMEM;
+    }
+    ub->uart = uart;
+    k_sem_init(&ub->sem_rx, 0, 1);
+
+#if defined(CONFIG_UART_BROKER_TX_ASYNC)
+    int err;
+
+    k_sem_init(&ub->sem_tx_space, 0, 1);
+    err = uart_callback_set(uart, uart_broker_async_cb, ub);
+    if (err) {
+        return err;
+    }
+    ub->rx_dma_next = 1;
+    err = uart_rx_enable(uart, ub->rx_dma_buff[0], RX_DMA_SZ, CONFIG_UART_BROKER_RX_TIMEOUT_US);
+    if (err) {
+        return err;
+    }
+#else
+    k_tid_t tid;
 
-    // スレッド作成
-    tid_ub = k_thread_create(&thread_ub, stack_ub, STACK_UB_SZ, uart_broker_thread, (void *)uart, NULL, NULL, PRIORITY, 0, K_NO_WAIT);
-    k_thread_name_set(tid_ub, "uart broker");
-    k_thread_start(&thread_ub);
+    // 送信キュー作成
+    k_msgq_init(&ub->msgq_tx, (char *)ub->tx_buff, 1, ub->tx_sz);
 
+    // スレッド作成(バルクのチャンネルは対話的な出力より低い優先度)
+    tid = k_thread_create(&ub->thread_ub, stack_ub[ub->ch], STACK_UB_SZ, uart_broker_thread, ub, NULL, NULL,
+                          (ub->qos == UART_BROKER_QOS_BULK) ? PRIORITY_BULK : PRIORITY, 0, K_NO_WAIT);
+    k_thread_name_set(tid, (ub->ch == UART_BROKER_CONSOLE) ? "uart broker" : "uart broker data");
+#endif
+
+    ub->ready = true;
     return 0;
 }
 
+/** Interface **/
+
+int UartBrokerChInit(enum uart_broker_ch ch, const struct device *uart, enum uart_broker_qos qos)
+{
+    struct uart_broker *ub;
+
+    if (ch >= UART_BROKER_CH_NUM) {
+        return -EINVAL;
+    }
+    if (!device_is_ready(uart)) {
+        return -ENODEV;
+    }
+    ub = &brokers[ch];
+    if (ub->ready) {
+        return -EALREADY;
+    }
+    ub->ch = ch;
+    ub->qos = qos;
+    // エコーバックはコンソールだけ
+    atomic_set(&ub->is_echo, (ch == UART_BROKER_CONSOLE) ? 1 : 0);
+    ub->tx_sz = UART_TX_BUF_SZ;
+    ub->rx_sz = UART_RX_BUF_SZ;
+#if defined(CONFIG_UART_BROKER_DATA)
+    if (ch == UART_BROKER_DATA) {
+        ub->tx_sz = UART_DATA_TX_BUF_SZ;
+        ub->rx_sz = UART_DATA_RX_BUF_SZ;
+    }
+#endif
+    return uart_broker_init(ub, uart);
+}
+
+bool UartBrokerChReady(enum uart_broker_ch ch)
+{
+    return (ch < UART_BROKER_CH_NUM) && brokers[ch].ready;
+}
+
+bool UartBrokerChSetEcho(enum uart_broker_ch ch, bool echo)
+{
+    atomic_set(&uart_broker_lookup(ch)->is_echo, echo ? 1 : 0);
+    return echo;
+}
+
+int UartBrokerChPut(enum uart_broker_ch ch, uint8_t *data, int len)
+{
+    return uart_broker_put(uart_broker_lookup(ch), data, len);
+}
+
+int UartBrokerChPuts(enum uart_broker_ch ch, const char *msg)
+{
+    return uart_broker_put(uart_broker_lookup(ch), (uint8_t *)msg, strlen(msg));
+}
+
+int UartBrokerChVPrintf(enum uart_broker_ch ch, const char *fmt, va_list ap)
+{
+    return uart_broker_vprintf(uart_broker_lookup(ch), fmt, ap);
+}
+
+int UartBrokerChPrintf(enum uart_broker_ch ch, const char *fmt, ...)
+{
+    va_list ap;
+    int len;
+
+    va_start(ap, fmt);
+    len = uart_broker_vprintf(uart_broker_lookup(ch), fmt, ap);
+    va_end(ap);
+    return len;
+}
+
+int UartBrokerChGet(enum uart_broker_ch ch, uint8_t *data, int len)
+{
+    return uart_broker_get(uart_broker_lookup(ch), data, len);
+}
+
+int UartBrokerChReadLine(enum uart_broker_ch ch, char *line, int size, int timeout_ms)
+{
+    return uart_broker_read_line(uart_broker_lookup(ch), line, size, timeout_ms);
+}
+
+void UartBrokerChGetActivity(enum uart_broker_ch ch, struct uart_broker_activity *act)
+{
+    struct uart_broker *ub = uart_broker_lookup(ch);
+    k_spinlock_key_t key = k_spin_lock(&ub->lock_act);
+    uint64_t total_us = (uint64_t)(k_uptime_get() - ub->act_since_ms) * USEC_PER_MSEC;
+    act->wakeups = ub->act_wakeups;
+    act->active_us = k_cyc_to_us_floor64(ub->act_active_cyc);
+    k_spin_unlock(&ub->lock_act, key);
+    act->idle_us = (total_us > act->active_us) ? (total_us - act->active_us) : 0;
+}
+
+void UartBrokerChGetStats(enum uart_broker_ch ch, struct uart_broker_stats *st)
+{
+    struct uart_broker *ub = uart_broker_lookup(ch);
+
+    st->tx_bytes = atomic_get(&ub->st_tx_bytes);
+    st->tx_drops = atomic_get(&ub->st_tx_drops);
+    st->tx_hwm = atomic_get(&ub->st_tx_hwm);
+    st->tx_blocked_us = atomic_get(&ub->st_tx_blocked_us);
+    st->rx_bytes = atomic_get(&ub->st_rx_bytes);
+    st->rx_drops = atomic_get(&ub->st_rx_drops);
+    st->rx_hwm = atomic_get(&ub->st_rx_hwm);
+}
+
+void UartBrokerChResetStats(enum uart_broker_ch ch)
+{
+    struct uart_broker *ub = uart_broker_lookup(ch);
+
+    atomic_clear(&ub->st_tx_bytes);
+    atomic_clear(&ub->st_tx_drops);
+    atomic_clear(&ub->st_tx_hwm);
+    atomic_clear(&ub->st_tx_blocked_us);
+    atomic_clear(&ub->st_rx_bytes);
+    atomic_clear(&ub->st_rx_drops);
+    atomic_clear(&ub->st_rx_hwm);
+}
+
+void UartBrokerChGetBufSize(enum uart_broker_ch ch, uint32_t *tx, uint32_t *rx)
+{
+    struct uart_broker *ub = uart_broker_lookup(ch);
+
+    *tx = ub->tx_sz;
+    *rx = ub->rx_sz;
+}
+
+/* Console channel */
+
+int UartBrokerInit(const struct device *uart)
+{
+    return UartBrokerChInit(UART_BROKER_CONSOLE, uart, UART_BROKER_QOS_INTERACTIVE);
+}
+
 int UartBrokerTerm(void)
 {
     return 0;
@@ -142,8 +744,98 @@ int UartBrokerTerm(void)
 
 bool UartBrokerSetEcho(bool echo)
 {
-    k_mutex_lock(&mutex_is_echo, K_FOREVER);
-    is_echo = echo;
-    k_mutex_unlock(&mutex_is_echo);
-    return echo;
+    return UartBrokerChSetEcho(UART_BROKER_CONSOLE, echo);
+}
+
+int UartBrokerPutByte(uint8_t byte)
+{
+#if defined(CONFIG_UART_BROKER_TX_ASYNC)
+    return (UartBrokerPut(&byte, 1) == 1) ? 0 : -EAGAIN;
+#else
+    return uart_broker_put_byte(&brokers[UART_BROKER_CONSOLE], byte);
+#endif
+}
+
+int UartBrokerPut(uint8_t *data, int len)
+{
+    return uart_broker_put(&brokers[UART_BROKER_CONSOLE], data, len);
+}
+
+int UartBrokerPuts(const char *msg)
+{
+    return UartBrokerPut((uint8_t *)msg, strlen(msg));
+}
+
+int UartBrokerVPrintf(const char *fmt, va_list ap)
+{
+    return uart_broker_vprintf(&brokers[UART_BROKER_CONSOLE], fmt, ap);
+}
+
+int UartBrokerPrintf(const char *fmt, ...)
+{
+    va_list ap;
+    int len;
+
+    va_start(ap, fmt);
+    len = UartBrokerVPrintf(fmt, ap);
+    va_end(ap);
+    return len;
+}
+
+int UartBrokerGetByte(uint8_t *byte)
+{
+    return UartBrokerGetByteTm(byte, 1);
+}
+
+int UartBrokerGetByteTm(uint8_t *byte, int timeout_ms)
+{
+    uint8_t *data;
+    if (UartBrokerGetBulk(&data, timeout_ms) <= 0) {
+        return -EAGAIN;
+    }
+    *byte = *data;
+    UartBrokerGetBulkFinish(1);
+    return 0;
+}
+
+void UartBrokerClearRecveiveQueue(void)
+{
+    struct uart_broker *ub = &brokers[UART_BROKER_CONSOLE];
+
+    atomic_set(&ub->rx_tail, atomic_get(&ub->rx_head));
+}
+
+int UartBrokerGet(uint8_t *data, int len)
+{
+    return uart_broker_get(&brokers[UART_BROKER_CONSOLE], data, len);
+}
+
+int UartBrokerGetBulk(uint8_t **data, int timeout_ms)
+{
+    return uart_broker_get_bulk(&brokers[UART_BROKER_CONSOLE], data, timeout_ms);
+}
+
+void UartBrokerGetBulkFinish(int len)
+{
+    atomic_add(&brokers[UART_BROKER_CONSOLE].rx_tail, len);
+}
+
+int UartBrokerReadLine(char *line, int size, int timeout_ms)
+{
+    return uart_broker_read_line(&brokers[UART_BROKER_CONSOLE], line, size, timeout_ms);
+}
+
+void UartBrokerGetActivity(struct uart_broker_activity *act)
+{
+    UartBrokerChGetActivity(UART_BROKER_CONSOLE, act);
+}
+
+void UartBrokerGetStats(struct uart_broker_stats *st)
+{
+    UartBrokerChGetStats(UART_BROKER_CONSOLE, st);
+}
+
+void UartBrokerResetStats(void)
+{
+    UartBrokerChResetStats(UART_BROKER_CONSOLE);
 }